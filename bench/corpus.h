@@ -0,0 +1,102 @@
+/* Synthetic todo corpora for the benchmarks. Output is a deterministic
+ * function of the size and seed, and mixes what real files contain:
+ * canonical items, other bullets and statuses, bare bullets, plain notes,
+ * blank lines, CRLF endings and the odd very long line. */
+#ifndef BENCH_CORPUS_H
+#define BENCH_CORPUS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *corpus_words[] = {
+    "fix", "deploy", "review", "write", "update", "alpha", "beta", "parser",
+    "release", "notes", "#ops", "#home", "@bob", "@alice", "due:2026-01-02",
+    "the", "and", "for", "build", "cache", "tests", "docs", "migrate", "db",
+};
+
+static uint64_t corpus_next(uint64_t *state) {
+    /* xorshift64* */
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+/* Append words to line until it holds at least len bytes */
+static size_t corpus_text(char *line, size_t at, size_t len, uint64_t *state) {
+    size_t nwords = sizeof(corpus_words) / sizeof(corpus_words[0]);
+    while (at < len) {
+        const char *w = corpus_words[corpus_next(state) % nwords];
+        size_t n = strlen(w);
+        memcpy(line + at, w, n);
+        at += n;
+        line[at++] = ' ';
+    }
+    return at - 1;
+}
+
+/* Write about bytes bytes of corpus to out; returns the number of lines */
+static uint64_t corpus_write(FILE *out, uint64_t bytes, uint64_t seed) {
+    static const char *prefixes[] = {
+        "- [ ] ", "- [x] ", "- [>] ", "- [X] ",     /* canonical */
+        "* [ ] ", "+ [x] ", "  - [>] ",             /* other bullets */
+        "- ", "* ",                                 /* no status */
+        "", "# ",                                   /* plain notes */
+    };
+    size_t cap = 64 * 1024 + 256;
+    char *line = malloc(cap);
+    uint64_t state = seed ? seed : 0x9e3779b97f4a7c15ULL;
+    uint64_t written = 0;
+    uint64_t lines = 0;
+
+    if (!line) return 0;
+    while (written < bytes) {
+        unsigned r = (unsigned)(corpus_next(&state) % 100);
+        size_t at;
+
+        if (r < 4) {
+            /* blank or whitespace-only */
+            at = r < 2 ? 0 : 3;
+            memset(line, ' ', at);
+        } else {
+            const char *prefix;
+            if (r < 64) prefix = prefixes[r % 4];
+            else if (r < 76) prefix = prefixes[4 + r % 3];
+            else if (r < 86) prefix = prefixes[7 + r % 2];
+            else prefix = prefixes[9 + r % 2];
+
+            size_t text = 12 + corpus_next(&state) % 60;
+            if (r == 99) text = 1024 + corpus_next(&state) % (63 * 1024);
+            at = strlen(prefix);
+            memcpy(line, prefix, at);
+            at = corpus_text(line, at, at + text, &state);
+        }
+
+        if (corpus_next(&state) % 20 == 0) line[at++] = '\r';
+        line[at++] = '\n';
+        fwrite(line, 1, at, out);
+        written += at;
+        lines++;
+    }
+
+    free(line);
+    return lines;
+}
+
+/* "1K", "64M", "10G" or plain bytes; 0 on error */
+static uint64_t corpus_size(const char *s) {
+    char *end;
+    uint64_t n = strtoull(s, &end, 10);
+    switch (*end) {
+        case 'K': case 'k': n <<= 10; end++; break;
+        case 'M': case 'm': n <<= 20; end++; break;
+        case 'G': case 'g': n <<= 30; end++; break;
+    }
+    return *end == '\0' ? n : 0;
+}
+
+#endif
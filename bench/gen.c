@@ -0,0 +1,15 @@
+/* Write a synthetic todo corpus to stdout, e.g. "bench/gen 10G > big.txt" */
+#include "corpus.h"
+
+int main(int argc, char **argv) {
+    uint64_t bytes = argc > 1 ? corpus_size(argv[1]) : 0;
+    uint64_t seed = argc > 2 ? strtoull(argv[2], NULL, 10) : 0;
+
+    if (bytes == 0) {
+        fprintf(stderr, "Usage: %s SIZE[K|M|G] [SEED]\n", argv[0]);
+        return 1;
+    }
+
+    corpus_write(stdout, bytes, seed);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
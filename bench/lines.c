@@ -0,0 +1,109 @@
+/* Line reading throughput: the old fixed 1024-byte fgets loop against
+ * LineReader, on short everyday lines and on very long ones.
+ *
+ * The fgets column is the reader chop used to have. On long lines it is
+ * not just slower to compare, it is wrong: every 1023 bytes becomes a new
+ * "line", which the lines column makes visible. */
+#include "chop.h"
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define CORPUS_BYTES (64 * 1024 * 1024)
+#define RUNS 3
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_corpus(char *path, size_t line_len) {
+    int fd = mkstemp(path);
+    if (fd < 0) return -1;
+
+    FILE *f = fdopen(fd, "w");
+    if (!f) return -1;
+
+    char *line = malloc(line_len + 1);
+    if (!line) return -1;
+    memcpy(line, "- [ ] ", 6);
+    for (size_t i = 6; i < line_len; i++) line[i] = 'a' + (char)(i % 26);
+    line[line_len] = '\n';
+
+    for (size_t written = 0; written < CORPUS_BYTES; written += line_len + 1) {
+        line[3] = " x>"[written % 3];
+        fwrite(line, 1, line_len + 1, f);
+    }
+
+    free(line);
+    fclose(f);
+    return 0;
+}
+
+static size_t run_fgets(const char *path) {
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    size_t n = 0;
+    while (fgets(line, sizeof(line), f)) n++;
+    fclose(f);
+    return n;
+}
+
+static size_t run_linereader(const char *path) {
+    int fd = open(path, O_RDONLY);
+    LineReader r;
+    const char *line;
+    size_t len, n = 0;
+    linereader_init(&r, fd);
+    while (linereader_next(&r, &line, &len) > 0) n++;
+    linereader_free(&r);
+    close(fd);
+    return n;
+}
+
+static size_t run_parse(const char *path) {
+    TodoList *list = todolist_new();
+    todolist_parse_file(list, path);
+    size_t n = list->count;
+    todolist_free(list);
+    return n;
+}
+
+static void bench(const char *name, size_t (*fn)(const char *), const char *path) {
+    double best = 0;
+    size_t lines = 0;
+
+    for (int i = 0; i < RUNS; i++) {
+        double t = now();
+        lines = fn(path);
+        t = now() - t;
+        if (i == 0 || t < best) best = t;
+    }
+
+    printf("  %-12s %9.1f MB/s %10zu lines\n", name, CORPUS_BYTES / best / 1e6, lines);
+}
+
+int main(void) {
+    static const struct { const char *name; size_t len; } cases[] = {
+        { "short (40 B)", 40 },
+        { "long (64 KB)", 64 * 1024 },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        char path[] = "/tmp/chop-bench-XXXXXX";
+        if (write_corpus(path, cases[i].len) < 0) {
+            perror("corpus");
+            return 1;
+        }
+
+        printf("%s lines, %d MB:\n", cases[i].name, CORPUS_BYTES / (1024 * 1024));
+        bench("fgets[1024]", run_fgets, path);
+        bench("LineReader", run_linereader, path);
+        bench("parse_file", run_parse, path);
+        unlink(path);
+    }
+
+    return 0;
+}
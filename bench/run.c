@@ -0,0 +1,248 @@
+/* Throughput harness for chop's hot paths. Each benchmark runs in a child
+ * process against generated corpora, so peak RSS is its own, and prints
+ * one JSON object per line:
+ *
+ *   {"bench":"cmd_filter","corpus":"64M","bytes":...,"lines":...,
+ *    "seconds":...,"mb_per_s":...,"lines_per_s":...,"peak_rss_kb":...,
+ *    "allocs":...,"kernel":"avx2"}
+ *
+ * Usage: bench/run [SIZE...]    sizes as for bench/gen, default 1K 1M 64M
+ *
+ * The CLI's internals are static, so main.c is compiled into this file
+ * with its main() renamed. allocs counts malloc, calloc and realloc calls
+ * where the C library lets them be wrapped (glibc), and is -1 elsewhere.
+ * kernel is the newline scanner picked for this CPU (or by CHOP_SCAN). */
+#define main chop_main
+#include "../main.c"
+#undef main
+
+#include "corpus.h"
+#include <sys/resource.h>
+
+#define RUNS 3
+
+#ifdef __GLIBC__
+static unsigned long alloc_count;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size) {
+    __sync_fetch_and_add(&alloc_count, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    __sync_fetch_and_add(&alloc_count, 1);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    __sync_fetch_and_add(&alloc_count, 1);
+    return __libc_realloc(p, size);
+}
+
+#define ALLOCS() ((long)alloc_count)
+#else
+#define ALLOCS() (-1L)
+#endif
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* What a child reports back to the parent */
+typedef struct {
+    double seconds;
+    long allocs;
+    long rss_kb;
+    int ok;
+} Result;
+
+static Sink null_sink;
+
+static int open_input(const char *path, FILE **fp, Input *in) {
+    *fp = fopen(path, "r");
+    if (!*fp) return -1;
+    if (input_open(in, *fp) < 0) {
+        fclose(*fp);
+        return -1;
+    }
+    return 0;
+}
+
+static int bench_parse_file(const char *path) {
+    TodoList *list = todolist_new();
+    int rc = list ? todolist_parse_file(list, path) : -1;
+    todolist_free(list);
+    return rc;
+}
+
+static int bench_read_todos(const char *path) {
+    FILE *fp;
+    Input in;
+    if (open_input(path, &fp, &in) < 0) return -1;
+
+    TodoList *list = read_todos(&in, NULL, NULL, NULL);
+    int rc = list ? 0 : -1;
+    todolist_free(list);
+    input_close(&in);
+    fclose(fp);
+    return rc;
+}
+
+/* The stream commands as "chop -it" and "chop -md -xd" run them */
+static int bench_stream(const char *path, int mark) {
+    Program prog;
+    char err[128];
+    FILE *fp;
+    Input in;
+    int rc;
+
+    if (expr_compile(&prog, mark ? "not is:done" : "is:todo", err, sizeof(err)) < 0) return -1;
+    if (open_input(path, &fp, &in) < 0) {
+        expr_free(&prog);
+        return -1;
+    }
+
+    if (mark) rc = cmd_status_stream(&in, &null_sink, 1, STATUS_DONE, &prog);
+    else rc = cmd_filter(&in, &null_sink, 1, &prog, NULL);
+    if (sink_flush(&null_sink) < 0) rc = -1;
+
+    input_close(&in);
+    fclose(fp);
+    expr_free(&prog);
+    return rc;
+}
+
+/* "chop --group-by=tag": every item tokenized, interned and grouped */
+static int bench_cmd_group(const char *path) {
+    Order order = ORDER_ALL;
+    Program prog;
+    char err[128];
+    FILE *fp;
+    Input in;
+
+    order.group = GROUP_TAG;
+    if (expr_compile(&prog, "", err, sizeof(err)) < 0) return -1;
+    if (open_input(path, &fp, &in) < 0) {
+        expr_free(&prog);
+        return -1;
+    }
+
+    int rc = cmd_filter(&in, &null_sink, 1, &prog, &order);
+    if (sink_flush(&null_sink) < 0) rc = -1;
+
+    input_close(&in);
+    fclose(fp);
+    expr_free(&prog);
+    return rc;
+}
+
+static int bench_cmd_filter(const char *path) {
+    return bench_stream(path, 0);
+}
+
+static int bench_cmd_status_stream(const char *path) {
+    return bench_stream(path, 1);
+}
+
+static const struct {
+    const char *name;
+    int (*fn)(const char *path);
+} benches[] = {
+    { "todolist_parse_file", bench_parse_file },
+    { "read_todos", bench_read_todos },
+    { "cmd_filter", bench_cmd_filter },
+    { "cmd_status_stream", bench_cmd_status_stream },
+    { "cmd_group", bench_cmd_group },
+};
+
+/* Best of RUNS, measured in a fresh child */
+static int run_child(int (*fn)(const char *), const char *path, Result *res) {
+    int fds[2];
+    if (pipe(fds) < 0) return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        Result r = { 0, 0, 0, 1 };
+        int devnull = open("/dev/null", O_WRONLY);
+        sink_init_fd(&null_sink, devnull);
+
+        for (int i = 0; i < RUNS; i++) {
+            long allocs = ALLOCS();
+            double t = now();
+            if (fn(path) != 0) r.ok = 0;
+            t = now() - t;
+            if (i == 0 || t < r.seconds) r.seconds = t;
+            r.allocs = ALLOCS() < 0 ? -1 : ALLOCS() - allocs;
+        }
+
+        struct rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) == 0) r.rss_kb = ru.ru_maxrss;
+
+        ssize_t n = write(fds[1], &r, sizeof(r));
+        _exit(n == (ssize_t)sizeof(r) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return -1;
+    }
+
+    ssize_t n = read(fds[0], res, sizeof(*res));
+    close(fds[0]);
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0 || n != (ssize_t)sizeof(*res)) return -1;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    static const char *defaults[] = { "1K", "1M", "64M" };
+    const char **sizes = argc > 1 ? (const char **)argv + 1 : defaults;
+    int nsizes = argc > 1 ? argc - 1 : (int)(sizeof(defaults) / sizeof(defaults[0]));
+
+    for (int s = 0; s < nsizes; s++) {
+        uint64_t bytes = corpus_size(sizes[s]);
+        if (bytes == 0) {
+            fprintf(stderr, "Invalid size: %s\n", sizes[s]);
+            return 1;
+        }
+
+        char path[] = "/tmp/chop-bench-XXXXXX";
+        int fd = mkstemp(path);
+        FILE *f = fd < 0 ? NULL : fdopen(fd, "w");
+        if (!f) {
+            perror("corpus");
+            return 1;
+        }
+        uint64_t lines = corpus_write(f, bytes, 0);
+        long size = ftell(f);
+        fclose(f);
+
+        for (size_t b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+            Result r;
+            if (run_child(benches[b].fn, path, &r) < 0 || !r.ok) {
+                fprintf(stderr, "%s on %s failed\n", benches[b].name, sizes[s]);
+                unlink(path);
+                return 1;
+            }
+
+            printf("{\"bench\":\"%s\",\"corpus\":\"%s\",\"bytes\":%ld,\"lines\":%llu,"
+                   "\"seconds\":%.6f,\"mb_per_s\":%.1f,\"lines_per_s\":%.0f,"
+                   "\"peak_rss_kb\":%ld,\"allocs\":%ld,\"kernel\":\"%s\"}\n",
+                   benches[b].name, sizes[s], size, (unsigned long long)lines,
+                   r.seconds, size / r.seconds / 1e6, lines / r.seconds, r.rss_kb, r.allocs,
+                   scan_kernel());
+            fflush(stdout);
+        }
+        unlink(path);
+    }
+
+    return 0;
+}
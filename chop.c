@@ -1,12 +1,361 @@
 #include "chop.h"
+#include "scan.h"
+#include "prof.h"
 #include <string.h>
-#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define INITIAL_CAPACITY 16
+#define NO_INDEX ((size_t)-1)
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define READER_BUFSIZE (64 * 1024)
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t used;
+    size_t size;
+    char data[];
+};
+
+void arena_init(Arena *arena) {
+    arena->head = NULL;
+}
+
+void *arena_alloc(Arena *arena, size_t size) {
+    ArenaBlock *b = arena->head;
+
+    if (!b || b->size - b->used < size) {
+        /* Oversized requests get a block of their own */
+        size_t cap = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(ArenaBlock) + cap);
+        if (!b) return NULL;
+        PROF_COUNT(PROF_ALLOCS, 1);
+        b->used = 0;
+        b->size = cap;
+        b->next = arena->head;
+        arena->head = b;
+    }
+
+    void *p = b->data + b->used;
+    b->used += size;
+    return p;
+}
+
+char *arena_strndup(Arena *arena, const char *s, size_t len) {
+    char *p = arena_alloc(arena, len + 1);
+    if (!p) return NULL;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+/* Drop everything but keep the newest block for reuse */
+void arena_reset(Arena *arena) {
+    ArenaBlock *b = arena->head;
+    if (!b) return;
+
+    ArenaBlock *rest = b->next;
+    while (rest) {
+        ArenaBlock *next = rest->next;
+        free(rest);
+        rest = next;
+    }
+    b->next = NULL;
+    b->used = 0;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *b = arena->head;
+    while (b) {
+        ArenaBlock *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->head = NULL;
+}
+
+/* FNV-1a: names are short, so a byte at a time is plenty */
+static uint32_t dict_hash(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ (unsigned char)s[i]) * 16777619u;
+    return h;
+}
+
+void dict_init(Dict *d) {
+    memset(d, 0, sizeof(*d));
+    arena_init(&d->arena);
+}
+
+void dict_free(Dict *d) {
+    arena_free(&d->arena);
+    free(d->names);
+    free(d->lens);
+    free(d->slots);
+    dict_init(d);
+}
+
+/* The slot holding s, or the empty slot where it belongs */
+static size_t dict_slot(const Dict *d, const char *s, size_t len) {
+    size_t j = dict_hash(s, len) & d->mask;
+
+    for (;;) {
+        uint32_t e = d->slots[j];
+        if (!e) return j;
+        if (d->lens[e - 1] == len && memcmp(d->names[e - 1], s, len) == 0) return j;
+        j = (j + 1) & d->mask;
+    }
+}
+
+static int dict_grow(Dict *d) {
+    size_t size = d->slots ? (d->mask + 1) * 2 : 64;
+    uint32_t *slots = calloc(size, sizeof(uint32_t));
+    if (!slots) return -1;
+
+    free(d->slots);
+    d->slots = slots;
+    d->mask = size - 1;
+    for (size_t id = 0; id < d->count; id++) {
+        d->slots[dict_slot(d, d->names[id], d->lens[id])] = (uint32_t)id + 1;
+    }
+    return 0;
+}
+
+int dict_find(const Dict *d, const char *s, size_t len) {
+    if (!d->slots) return -1;
+    return (int)d->slots[dict_slot(d, s, len)] - 1;
+}
+
+int dict_intern(Dict *d, const char *s, size_t len) {
+    if (len > UINT32_MAX || d->count >= INT32_MAX) return -1;
+    if (d->count + 1 > (d->mask + 1) / 2 && dict_grow(d) < 0) return -1;
+
+    size_t j = dict_slot(d, s, len);
+    if (d->slots[j]) return (int)d->slots[j] - 1;
+
+    if (d->count == d->cap) {
+        size_t cap = d->cap ? d->cap * 2 : INITIAL_CAPACITY;
+        const char **names = realloc(d->names, sizeof(char *) * cap);
+        if (!names) return -1;
+        d->names = names;
+        uint32_t *lens = realloc(d->lens, sizeof(uint32_t) * cap);
+        if (!lens) return -1;
+        d->lens = lens;
+        d->cap = cap;
+    }
+
+    char *name = arena_strndup(&d->arena, s, len);
+    if (!name) return -1;
+    d->names[d->count] = name;
+    d->lens[d->count] = (uint32_t)len;
+    d->slots[j] = (uint32_t)d->count + 1;
+    return (int)d->count++;
+}
+
+const char *dict_name(const Dict *d, int id, size_t *len) {
+    if (id < 0 || (size_t)id >= d->count) return NULL;
+    if (len) *len = d->lens[id];
+    return d->names[id];
+}
+
+int linereader_init(LineReader *r, int fd) {
+    r->buf = malloc(READER_BUFSIZE);
+    if (!r->buf) return -1;
+    PROF_COUNT(PROF_ALLOCS, 1);
+    r->fd = fd;
+    r->cap = READER_BUFSIZE;
+    r->start = r->scan = r->end = 0;
+    r->eof = 0;
+    r->nl_next = r->nl_count = 0;
+    return 0;
+}
+
+void linereader_free(LineReader *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/* Is another line already buffered, i.e. can next() answer without read()? */
+int linereader_pending(const LineReader *r) {
+    if (r->nl_next < r->nl_count) return 1;
+    if (r->start == r->end) return 0;
+    return r->eof || scan_newline(r->buf + r->scan, r->end - r->scan) < r->end - r->scan;
+}
+
+int linereader_next(LineReader *r, const char **line, size_t *len) {
+    for (;;) {
+        /* Newlines are found a batch at a time and queued. Only bytes not
+         * yet searched are scanned, so a long line that needs several
+         * refills is still walked exactly once. */
+        if (r->nl_next == r->nl_count) {
+            PROF_BEGIN(t);
+            size_t base = r->scan;
+            size_t max = sizeof(r->nl) / sizeof(r->nl[0]);
+            r->nl_count = scan_newlines(r->buf + base, r->end - base, r->nl, max);
+            for (size_t i = 0; i < r->nl_count; i++) r->nl[i] += base;
+            r->nl_next = 0;
+            r->scan = r->nl_count == max ? r->nl[max - 1] + 1 : r->end;
+            PROF_END(PHASE_READ, t);
+        }
+
+        if (r->nl_next < r->nl_count) {
+            size_t nl = r->nl[r->nl_next++];
+            *line = r->buf + r->start;
+            *len = nl + 1 - r->start;
+            r->start = nl + 1;
+            return 1;
+        }
+
+        if (r->eof) {
+            if (r->start == r->end) return 0;
+            /* Final line without a terminator */
+            *line = r->buf + r->start;
+            *len = r->end - r->start;
+            r->start = r->scan = r->end;
+            return 1;
+        }
+
+        /* The queue is empty here, so no stored offset is invalidated.
+         * Slide the partial line to the front, growing only if it alone
+         * fills the buffer */
+        if (r->start > 0) {
+            memmove(r->buf, r->buf + r->start, r->end - r->start);
+            r->end -= r->start;
+            r->scan -= r->start;
+            r->start = 0;
+        }
+        if (r->end == r->cap) {
+            char *grown = realloc(r->buf, r->cap * 2);
+            if (!grown) return -1;
+            PROF_COUNT(PROF_ALLOCS, 1);
+            r->buf = grown;
+            r->cap *= 2;
+        }
+
+        PROF_BEGIN(t);
+        ssize_t n = read(r->fd, r->buf + r->end, r->cap - r->end);
+        PROF_END(PHASE_READ, t);
+        PROF_COUNT(PROF_READS, 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        PROF_COUNT(PROF_BYTES_IN, n);
+        if (n == 0) r->eof = 1;
+        r->end += (size_t)n;
+    }
+}
+
+void sink_init_fd(Sink *s, int fd) {
+    s->fd = fd;
+    s->fp = NULL;
+    s->len = 0;
+    s->err = 0;
+}
+
+void sink_init_file(Sink *s, FILE *fp) {
+    sink_init_fd(s, -1);
+    s->fp = fp;
+}
+
+static int sink_emit(Sink *s, const char *data, size_t len) {
+    if (s->err) return -1;
+
+    if (s->fd < 0) {
+        errno = 0;
+        if (fwrite(data, 1, len, s->fp) != len) {
+            s->err = errno ? errno : EIO;
+            return -1;
+        }
+        return 0;
+    }
+
+    /* Only descriptor sinks are profiled: in the CLI, FILE sinks are
+     * memory buffers that a descriptor sink writes out later */
+    PROF_BEGIN(t);
+    PROF_COUNT(PROF_BYTES_OUT, len);
+    while (len > 0) {
+        ssize_t n = write(s->fd, data, len);
+        PROF_COUNT(PROF_WRITES, 1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            s->err = errno;
+            break;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+    PROF_END(PHASE_WRITE, t);
+    return s->err ? -1 : 0;
+}
+
+int sink_flush(Sink *s) {
+    int rc = sink_emit(s, s->buf, s->len);
+    s->len = 0;
+    return rc;
+}
+
+int sink_write(Sink *s, const void *data, size_t len) {
+    if (len > sizeof(s->buf) - s->len) {
+        if (sink_flush(s) < 0) return -1;
+        /* Too big to be worth copying */
+        if (len >= sizeof(s->buf)) return sink_emit(s, data, len);
+    }
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+    return 0;
+}
+
+int sink_todo(Sink *s, const Todo *todo) {
+    char prefix[6] = { '-', ' ', '[', status_to_char(todo->status), ']', ' ' };
+
+    if (sizeof(prefix) + todo->text_len + 1 > sizeof(s->buf) - s->len) {
+        if (sink_write(s, prefix, sizeof(prefix)) < 0) return -1;
+        if (sink_write(s, todo->text, todo->text_len) < 0) return -1;
+        return sink_write(s, "\n", 1);
+    }
+
+    char *p = s->buf + s->len;
+    memcpy(p, prefix, sizeof(prefix));
+    memcpy(p + sizeof(prefix), todo->text, todo->text_len);
+    p[sizeof(prefix) + todo->text_len] = '\n';
+    s->len += sizeof(prefix) + todo->text_len + 1;
+    return 0;
+}
+
+/* Build "id\t[c] " backwards from end, which has room for 32 bytes, and
+ * return where it starts */
+static char *numbered_head(const Todo *todo, char *end) {
+    char *p = end;
+    unsigned id = (unsigned)todo->id;
+
+    *--p = ' ';
+    *--p = ']';
+    *--p = status_to_char(todo->status);
+    *--p = '[';
+    *--p = '\t';
+    do {
+        *--p = (char)('0' + id % 10);
+        id /= 10;
+    } while (id);
+    if (todo->id < 0) *--p = '-';
+    return p;
+}
+
+/* "id\t[c] text\n", the listing format of todo_print */
+static int sink_todo_numbered(Sink *s, const Todo *todo) {
+    char head[32];
+    char *p = numbered_head(todo, head + sizeof(head));
+
+    if (sink_write(s, p, (size_t)(head + sizeof(head) - p)) < 0) return -1;
+    if (sink_write(s, todo->text, todo->text_len) < 0) return -1;
+    return sink_write(s, "\n", 1);
+}
 
 TodoList *todolist_new(void) {
     TodoList *list = malloc(sizeof(TodoList));
     if (!list) return NULL;
+    PROF_COUNT(PROF_ALLOCS, 2);
 
     list->items = malloc(sizeof(Todo) * INITIAL_CAPACITY);
     if (!list->items) {
@@ -14,18 +363,34 @@ TodoList *todolist_new(void) {
         return NULL;
     }
 
+    list->meta = malloc(sizeof(TodoMeta) * INITIAL_CAPACITY);
+    if (!list->meta) {
+        free(list->items);
+        free(list);
+        return NULL;
+    }
+    PROF_COUNT(PROF_ALLOCS, 1);
+
     list->count = 0;
     list->capacity = INITIAL_CAPACITY;
+    list->index = NULL;
+    list->index_cap = 0;
+    list->next_id = 1;
+    arena_init(&list->arena);
+    dict_init(&list->names);
+    memset(&list->labels, 0, sizeof(list->labels));
+    list->labels.heap = 1;
     return list;
 }
 
 void todolist_free(TodoList *list) {
     if (!list) return;
 
-    for (size_t i = 0; i < list->count; i++) {
-        free(list->items[i].text);
-        free(list->items[i].raw_line);
-    }
+    arena_free(&list->arena);
+    dict_free(&list->names);
+    labelbuf_free(&list->labels);
+    free(list->index);
+    free(list->meta);
     free(list->items);
     free(list);
 }
@@ -34,158 +399,609 @@ static int todolist_grow(TodoList *list) {
     size_t new_cap = list->capacity * 2;
     Todo *new_items = realloc(list->items, sizeof(Todo) * new_cap);
     if (!new_items) return -1;
+    PROF_COUNT(PROF_ALLOCS, 1);
 
     list->items = new_items;
+    TodoMeta *new_meta = realloc(list->meta, sizeof(TodoMeta) * new_cap);
+    if (!new_meta) return -1;
+    PROF_COUNT(PROF_ALLOCS, 1);
+
+    list->meta = new_meta;
     list->capacity = new_cap;
     return 0;
 }
 
-static TodoStatus parse_status_marker(const char *marker) {
-    if (strcmp(marker, "[ ]") == 0) return STATUS_TODO;
-    if (strcmp(marker, "[x]") == 0 || strcmp(marker, "[X]") == 0) return STATUS_DONE;
-    if (strcmp(marker, "[>]") == 0) return STATUS_IN_PROGRESS;
-    return STATUS_TODO;
+/* Record that id lives at items[pos]. Ids are handed out densely and in
+ * order, so the table is a plain array indexed by id - 1. */
+static int todolist_index(TodoList *list, int id, size_t pos) {
+    if (id < 1) return 0;
+    size_t slot = (size_t)id - 1;
+
+    if (slot >= list->index_cap) {
+        size_t new_cap = list->index_cap ? list->index_cap * 2 : INITIAL_CAPACITY;
+        while (new_cap <= slot) new_cap *= 2;
+        size_t *new_index = realloc(list->index, sizeof(size_t) * new_cap);
+        if (!new_index) return -1;
+        PROF_COUNT(PROF_ALLOCS, 1);
+        /* Unused slots are marked as missing */
+        memset(new_index + list->index_cap, 0xff, sizeof(size_t) * (new_cap - list->index_cap));
+        list->index = new_index;
+        list->index_cap = new_cap;
+    }
+
+    /* The first item with a given id wins, as a linear scan would find */
+    if (list->index[slot] == NO_INDEX) list->index[slot] = pos;
+    if (id >= list->next_id) list->next_id = id + 1;
+    return 0;
 }
 
-static int parse_line(const char *line, Todo *todo, int id) {
-    /* Skip leading whitespace */
-    while (*line && isspace(*line)) line++;
+Todo *todolist_push(TodoList *list, const Todo *todo) {
+    if (list->count >= list->capacity) {
+        if (todolist_grow(list) < 0) return NULL;
+    }
+    TodoMeta *meta = &list->meta[list->count];
+    size_t labels = list->labels.count;
+    if (todo_meta_intern(&list->names, todo->text, todo->text ? todo->text_len : 0, &list->labels, meta) < 0 ||
+        (todo->text && todolist_index(list, todo->id, list->count) < 0)) {
+        list->labels.count = labels;
+        return NULL;
+    }
 
-    /* Skip empty lines */
-    if (*line == '\0' || *line == '\n') return -1;
+    list->items[list->count] = *todo;
+    return &list->items[list->count++];
+}
 
-    /* Check for list marker "- " */
-    if (line[0] != '-' || line[1] != ' ') return -1;
-    line += 2;
+static void parse_line(const char *line, size_t len, Todo *todo, int id) {
+    const char *end = line + len;
 
-    /* Skip whitespace after marker */
-    while (*line && isspace(*line)) line++;
+    todo->raw_line = (char *)line;
+    todo->raw_len = len;
+    todo->status = STATUS_TODO;
+    todo->text = NULL;
+    todo->text_len = 0;
+    todo->id = 0;
 
-    /* Parse status [x], [ ], [>] */
-    if (line[0] != '[') return -1;
+    /* Canonical "- [c] " lines skip straight to the text */
+    const char *text_start;
+    size_t prefix = scan_marker(line, len, &todo->status);
+    if (prefix) {
+        text_start = line + prefix;
+        while (text_start < end && *text_start == ' ') text_start++;
+    } else {
+        const char *p = line;
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
 
-    char marker[4] = {0};
-    strncpy(marker, line, 3);
-    marker[3] = '\0';
+        /* Skip empty lines */
+        const char *e = end;
+        while (e > p && (e[-1] == '\n' || e[-1] == '\r' || e[-1] == ' ')) e--;
+        if (e == p) return;
 
-    todo->status = parse_status_marker(marker);
-    line += 3;
+        text_start = p;
 
-    /* Skip whitespace after status */
-    while (*line && isspace(*line)) line++;
+        /* Check for list marker */
+        if ((*p == '-' || *p == '*' || *p == '+') && end - p > 1 && p[1] == ' ') {
+            p += 2;
+            while (p < end && *p == ' ') p++;
+            text_start = p;
 
-    /* Rest is the text (trim trailing newline) */
-    size_t len = strlen(line);
-    while (len > 0 && (line[len-1] == '\n' || line[len-1] == '\r')) {
-        len--;
+            /* Check for status marker */
+            if (end - p >= 3 && p[0] == '[' && p[2] == ']') {
+                if (p[1] == 'x' || p[1] == 'X') todo->status = STATUS_DONE;
+                else if (p[1] == '>') todo->status = STATUS_IN_PROGRESS;
+                else todo->status = STATUS_TODO;
+                p += 3;
+                while (p < end && *p == ' ') p++;
+                text_start = p;
+            }
+        }
     }
 
-    todo->text = malloc(len + 1);
-    if (!todo->text) return -1;
+    /* Extract text */
+    const char *text_end = end;
+    while (text_end > text_start && (text_end[-1] == '\n' || text_end[-1] == '\r')) text_end--;
 
-    strncpy(todo->text, line, len);
-    todo->text[len] = '\0';
-    todo->id = id;
+    if (text_end > text_start) {
+        todo->text = (char *)text_start;
+        todo->text_len = (size_t)(text_end - text_start);
+        todo->id = id;
+    }
+}
 
-    return 0;
+void todo_parse(const char *line, size_t len, Todo *todo, int id) {
+    PROF_BEGIN(t);
+    parse_line(line, len, todo, id);
+    PROF_END(PHASE_PARSE, t);
+    PROF_COUNT(PROF_LINES, 1);
+    PROF_COUNT(todo->text ? PROF_TODOS : PROF_RAW, 1);
 }
 
-int todolist_parse_file(TodoList *list, const char *filename) {
-    FILE *f = fopen(filename, "r");
-    if (!f) return -1;
+int todo_classify(const char *line, size_t len, TodoStatus *status) {
+    /* A canonical marker followed by a visible character needs no more */
+    if (scan_marker(line, len, status) && line[6] != ' ' && line[6] != '\n' && line[6] != '\r') {
+        PROF_COUNT(PROF_LINES, 1);
+        PROF_COUNT(PROF_TODOS, 1);
+        return 1;
+    }
+
+    Todo todo;
+    todo_parse(line, len, &todo, 1);
+    *status = todo.status;
+    return todo.text != NULL;
+}
+
+static int meta_name_char(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+           c >= 0x80 || c == '-' || c == '_' || c == '/' || c == '.';
+}
+
+static int meta_digits(const char *p, size_t n, int *value) {
+    *value = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (p[i] < '0' || p[i] > '9') return 0;
+        *value = *value * 10 + (p[i] - '0');
+    }
+    return 1;
+}
+
+/* "YYYY-MM-DD" at p, which has at least 10 bytes */
+static int meta_date(const char *p, int32_t *due) {
+    int y, m, d;
+    if (!meta_digits(p, 4, &y) || p[4] != '-' || !meta_digits(p + 5, 2, &m) ||
+        p[7] != '-' || !meta_digits(p + 8, 2, &d)) {
+        return 0;
+    }
+    if (m < 1 || m > 12 || d < 1 || d > 31) return 0;
+    *due = y * 10000 + m * 100 + d;
+    return 1;
+}
+
+int todo_meta_date(const char *s, size_t len, int32_t *due) {
+    return len == 10 && meta_date(s, due);
+}
+
+/* Nonzero if any byte of w is '#', '@' or ':', the bytes a metadata word
+ * is found by; ':' stands in for the "due:" before it. Bytes above a
+ * match may be flagged too, which only costs a closer look. */
+static uint64_t meta_bytes(uint64_t w) {
+    const uint64_t ones = 0x0101010101010101ULL;
+    uint64_t a = w ^ (ones * '#');
+    uint64_t b = w ^ (ones * '@');
+    uint64_t c = w ^ (ones * ':');
+    return (((a - ones) & ~a) | ((b - ones) & ~b) | ((c - ones) & ~c)) & (ones << 7);
+}
+
+static int meta_word_start(const char *text, size_t i) {
+    return i == 0 || text[i - 1] == ' ' || text[i - 1] == '\t' || text[i - 1] == '(';
+}
 
-    char line[1024];
-    int id = 1;
+int todo_meta_next(const char *text, size_t len, size_t *pos, MetaToken *tok) {
+    size_t i = *pos;
 
-    while (fgets(line, sizeof(line), f)) {
-        if (list->count >= list->capacity) {
-            if (todolist_grow(list) < 0) {
-                fclose(f);
-                return -1;
+    while (i < len) {
+        /* Most text holds none of the bytes, so skip it a word at a time */
+        if (len - i >= 8) {
+            uint64_t w;
+            memcpy(&w, text + i, 8);
+            uint64_t m = meta_bytes(w);
+            if (!m) {
+                i += 8;
+                continue;
             }
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            /* The lowest flagged byte is always a real match */
+            i += (size_t)__builtin_ctzll(m) >> 3;
+#endif
         }
 
-        Todo *todo = &list->items[list->count];
-        memset(todo, 0, sizeof(Todo));
+        char c = text[i++];
+        if (c == ':') {
+            size_t end = i + 10;
+            if (i < 4 || memcmp(text + i - 4, "due", 3) != 0 || !meta_word_start(text, i - 4) ||
+                end > len || !meta_date(text + i, &tok->due) ||
+                (end < len && meta_name_char((unsigned char)text[end]))) {
+                continue;
+            }
+            tok->kind = META_DUE;
+            tok->name = text + i;
+            tok->len = 10;
+            *pos = end;
+            return 1;
+        }
+        if ((c != '#' && c != '@') || !meta_word_start(text, i - 1)) continue;
 
-        todo->raw_line = strdup(line);
+        size_t end = i;
+        while (end < len && meta_name_char((unsigned char)text[end])) end++;
+        while (end > i && text[end - 1] == '.') end--;
+        if (end == i || text[i] == '-' || text[i] == '/') continue;
+
+        tok->kind = c == '#' ? META_TAG : META_OWNER;
+        tok->name = text + i - 1;
+        tok->len = end - i + 1;
+        tok->due = 0;
+        *pos = end;
+        return 1;
+    }
 
-        if (parse_line(line, todo, id) == 0) {
-            list->count++;
-            id++;
-        } else {
-            /* Keep raw line for non-todo lines (comments, etc) */
-            todo->text = NULL;
-            todo->id = 0;
-            list->count++;
+    *pos = len;
+    return 0;
+}
+
+void labelbuf_free(LabelBuf *b) {
+    if (b->heap) free(b->ids);
+    b->ids = NULL;
+    b->count = b->cap = 0;
+    b->heap = 1;
+}
+
+static int labelbuf_push(LabelBuf *b, uint32_t id) {
+    if (b->count == b->cap) {
+        size_t cap = b->cap ? b->cap * 2 : INITIAL_CAPACITY;
+        uint32_t *ids = b->heap ? realloc(b->ids, sizeof(uint32_t) * cap) : malloc(sizeof(uint32_t) * cap);
+        if (!ids) return -1;
+        PROF_COUNT(PROF_ALLOCS, 1);
+        if (!b->heap && b->count) memcpy(ids, b->ids, sizeof(uint32_t) * b->count);
+        b->ids = ids;
+        b->cap = cap;
+        b->heap = 1;
+    }
+    b->ids[b->count++] = id;
+    return 0;
+}
+
+/* Both ways to tokenize metadata: names is only written when intern is set */
+static int meta_scan(Dict *names, int intern, const char *text, size_t len, LabelBuf *labels, TodoMeta *meta) {
+    MetaToken tok;
+    size_t pos = 0;
+
+    meta->first = (uint32_t)labels->count;
+    meta->count = 0;
+    meta->due = 0;
+    meta->due_id = -1;
+    while (todo_meta_next(text, len, &pos, &tok)) {
+        if (tok.kind == META_DUE && meta->due) continue;
+
+        int id = intern ? dict_intern(names, tok.name, tok.len) : dict_find(names, tok.name, tok.len);
+        if (id < 0 && intern) return -1;
+        if (tok.kind == META_DUE) {
+            meta->due = tok.due;
+            meta->due_id = id;
+            continue;
         }
+        if (id < 0) continue;
+
+        uint32_t i = 0;
+        while (i < meta->count && labels->ids[meta->first + i] != (uint32_t)id) i++;
+        if (i < meta->count) continue;
+        if (labels->count >= UINT32_MAX || labelbuf_push(labels, (uint32_t)id) < 0) return -1;
+        meta->count++;
     }
+    return 0;
+}
+
+int todo_meta_intern(Dict *names, const char *text, size_t len, LabelBuf *labels, TodoMeta *meta) {
+    return meta_scan(names, 1, text, len, labels, meta);
+}
 
-    fclose(f);
+int todo_meta_lookup(const Dict *names, const char *text, size_t len, LabelBuf *labels, TodoMeta *meta) {
+    return meta_scan((Dict *)names, 0, text, len, labels, meta);
+}
+
+void todoparser_init(TodoParser *p, int first_id, todo_cb cb, void *ctx) {
+    memset(p, 0, sizeof(*p));
+    p->cb = cb;
+    p->ctx = ctx;
+    p->next_id = first_id;
+}
+
+static int todoparser_emit(TodoParser *p, const char *line, size_t len) {
+    Todo todo;
+    todo_parse(line, len, &todo, p->next_id);
+    if (todo.text) p->next_id++;
+    return p->cb(&todo, p->ctx);
+}
+
+static int todoparser_keep(TodoParser *p, const char *data, size_t len) {
+    if (p->partial_len + len > p->partial_cap) {
+        size_t cap = p->partial_cap ? p->partial_cap : 256;
+        while (cap < p->partial_len + len) cap *= 2;
+        char *grown = realloc(p->partial, cap);
+        if (!grown) return -1;
+        PROF_COUNT(PROF_ALLOCS, 1);
+        p->partial = grown;
+        p->partial_cap = cap;
+    }
+    memcpy(p->partial + p->partial_len, data, len);
+    p->partial_len += len;
     return 0;
 }
 
+/* Lines that lie whole inside data are handed out in place; only a line
+ * split across feeds is copied */
+int todoparser_feed(TodoParser *p, const char *data, size_t len) {
+    int rc;
+
+    if (p->partial_len > 0) {
+        size_t nl = scan_newline(data, len);
+        if (nl == len) return todoparser_keep(p, data, len);
+        if (todoparser_keep(p, data, nl + 1) < 0) return -1;
+        data += nl + 1;
+        len -= nl + 1;
+
+        size_t line_len = p->partial_len;
+        p->partial_len = 0;
+        if ((rc = todoparser_emit(p, p->partial, line_len)) != 0) return rc;
+    }
+
+    while (len > 0) {
+        size_t nl[64];
+        size_t n = scan_newlines(data, len, nl, sizeof(nl) / sizeof(nl[0]));
+        size_t start = 0;
+
+        for (size_t i = 0; i < n; i++) {
+            rc = todoparser_emit(p, data + start, nl[i] + 1 - start);
+            start = nl[i] + 1;
+            if (rc != 0) return rc;
+        }
+        data += start;
+        len -= start;
+        if (n < sizeof(nl) / sizeof(nl[0])) break;
+    }
+
+    return len > 0 ? todoparser_keep(p, data, len) : 0;
+}
+
+int todoparser_finish(TodoParser *p) {
+    size_t len = p->partial_len;
+    p->partial_len = 0;
+    return len > 0 ? todoparser_emit(p, p->partial, len) : 0;
+}
+
+void todoparser_reset(TodoParser *p, int first_id) {
+    p->partial_len = 0;
+    p->next_id = first_id;
+}
+
+void todoparser_free(TodoParser *p) {
+    free(p->partial);
+    p->partial = NULL;
+    p->partial_len = p->partial_cap = 0;
+}
+
+/* Lines only live for the callback, so each one is copied into the
+ * list's arena and its text view moved along with it */
+static int todolist_keep(Todo *todo, void *ctx) {
+    TodoList *list = ctx;
+    char *raw = arena_strndup(&list->arena, todo->raw_line, todo->raw_len);
+    if (!raw) return -1;
+
+    if (todo->text) todo->text = raw + (todo->text - todo->raw_line);
+    todo->raw_line = raw;
+    return todolist_push(list, todo) ? 0 : -1;
+}
+
+/* Push a whole file through a TodoParser */
+static int parse_file(const char *filename, int first_id, todo_cb cb, void *ctx) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+
+    char *buf = malloc(READER_BUFSIZE);
+    if (!buf) {
+        close(fd);
+        return -1;
+    }
+
+    TodoParser parser;
+    todoparser_init(&parser, first_id, cb, ctx);
+
+    int rc = 0;
+    for (;;) {
+        PROF_BEGIN(t);
+        ssize_t n = read(fd, buf, READER_BUFSIZE);
+        PROF_END(PHASE_READ, t);
+        PROF_COUNT(PROF_READS, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n > 0) PROF_COUNT(PROF_BYTES_IN, n);
+        if (n < 0) rc = -1;
+        if (n <= 0) break;
+        if (todoparser_feed(&parser, buf, (size_t)n) != 0) {
+            rc = -1;
+            break;
+        }
+    }
+    if (rc == 0 && todoparser_finish(&parser) != 0) rc = -1;
+
+    todoparser_free(&parser);
+    free(buf);
+    close(fd);
+    return rc;
+}
+
+int todolist_parse_file(TodoList *list, const char *filename) {
+    return parse_file(filename, list->next_id, todolist_keep, list);
+}
+
 int todolist_write_file(TodoList *list, const char *filename) {
-    FILE *f = fopen(filename, "w");
-    if (!f) return -1;
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) return -1;
+
+    Sink *sink = malloc(sizeof(Sink));
+    if (!sink) {
+        close(fd);
+        return -1;
+    }
+    sink_init_fd(sink, fd);
 
     for (size_t i = 0; i < list->count; i++) {
         Todo *todo = &list->items[i];
 
         if (todo->text) {
-            fprintf(f, "- [%c] %s\n", status_to_char(todo->status), todo->text);
+            sink_todo(sink, todo);
         } else if (todo->raw_line) {
             /* Preserve non-todo lines as-is */
-            fputs(todo->raw_line, f);
+            sink_write(sink, todo->raw_line, todo->raw_len);
         }
     }
 
-    fclose(f);
-    return 0;
+    int rc = sink_flush(sink);
+    free(sink);
+    if (close(fd) < 0) rc = -1;
+    return rc;
 }
 
 int todolist_add(TodoList *list, const char *text) {
-    if (list->count >= list->capacity) {
-        if (todolist_grow(list) < 0) return -1;
+    Todo todo;
+    todo.id = list->next_id;
+    todo.status = STATUS_TODO;
+    todo.text_len = strlen(text);
+    todo.text = arena_strndup(&list->arena, text, todo.text_len);
+    todo.raw_line = NULL;
+    todo.raw_len = 0;
+
+    if (!todo.text) return -1;
+    if (!todolist_push(list, &todo)) return -1;
+    return todo.id;
+}
+
+int todolist_set_status(TodoList *list, int id, TodoStatus status) {
+    Todo *todo = todolist_get(list, id);
+    if (!todo) return -1;
+    todo->status = status;
+    return 0;
+}
+
+int todolist_set_status_many(TodoList *list, const int *ids, size_t n, TodoStatus status) {
+    int rc = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (todolist_set_status(list, ids[i], status) < 0) rc = -1;
     }
+    return rc;
+}
 
-    /* Find max id */
-    int max_id = 0;
-    for (size_t i = 0; i < list->count; i++) {
-        if (list->items[i].id > max_id) {
-            max_id = list->items[i].id;
-        }
+Todo *todolist_get(TodoList *list, int id) {
+    if (id < 1 || (size_t)id > list->index_cap) return NULL;
+
+    size_t pos = list->index[id - 1];
+    return pos == NO_INDEX ? NULL : &list->items[pos];
+}
+
+const TodoMeta *todolist_meta(const TodoList *list, int id) {
+    if (id < 1 || (size_t)id > list->index_cap) return NULL;
+
+    size_t pos = list->index[id - 1];
+    return pos == NO_INDEX ? NULL : &list->meta[pos];
+}
+
+void todotable_init(TodoTable *t) {
+    memset(t, 0, sizeof(*t));
+}
+
+void todotable_free(TodoTable *t) {
+    free(t->status);
+    free(t->text_off);
+    free(t->blob);
+    todotable_init(t);
+}
+
+int todotable_add(TodoTable *t, const Todo *todo) {
+    if (!todo->text) return 0;
+
+    if (t->count + 1 >= t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : INITIAL_CAPACITY;
+        uint8_t *status = realloc(t->status, cap);
+        if (!status) return -1;
+        t->status = status;
+        size_t *off = realloc(t->text_off, sizeof(size_t) * (cap + 1));
+        if (!off) return -1;
+        if (!t->text_off) off[0] = 0;
+        t->text_off = off;
+        t->cap = cap;
+        PROF_COUNT(PROF_ALLOCS, 2);
     }
 
-    Todo *todo = &list->items[list->count];
-    todo->id = max_id + 1;
-    todo->status = STATUS_TODO;
-    todo->text = strdup(text);
-    todo->raw_line = NULL;
+    if (t->blob_len + todo->text_len > t->blob_cap) {
+        size_t cap = t->blob_cap ? t->blob_cap * 2 : ARENA_BLOCK_SIZE;
+        while (cap < t->blob_len + todo->text_len) cap *= 2;
+        char *blob = realloc(t->blob, cap);
+        if (!blob) return -1;
+        PROF_COUNT(PROF_ALLOCS, 1);
+        t->blob = blob;
+        t->blob_cap = cap;
+    }
+
+    memcpy(t->blob + t->blob_len, todo->text, todo->text_len);
+    t->blob_len += todo->text_len;
+    t->status[t->count] = (uint8_t)todo->status;
+    t->text_off[++t->count] = t->blob_len;
+    return 0;
+}
 
-    if (!todo->text) return -1;
+static int todotable_keep(Todo *todo, void *ctx) {
+    return todotable_add(ctx, todo);
+}
 
-    list->count++;
-    return todo->id;
+int todotable_parse_file(TodoTable *t, const char *filename) {
+    return parse_file(filename, (int)t->count + 1, todotable_keep, t);
 }
 
-int todolist_set_status(TodoList *list, int id, TodoStatus status) {
+int todotable_from_list(TodoTable *t, const TodoList *list) {
     for (size_t i = 0; i < list->count; i++) {
-        if (list->items[i].id == id) {
-            list->items[i].status = status;
-            return 0;
-        }
+        if (todotable_add(t, &list->items[i]) < 0) return -1;
     }
-    return -1;
+    return 0;
 }
 
-Todo *todolist_get(TodoList *list, int id) {
-    for (size_t i = 0; i < list->count; i++) {
-        if (list->items[i].id == id) {
-            return &list->items[i];
-        }
+size_t todotable_count(const TodoTable *t) {
+    return t->count;
+}
+
+TodoStatus todotable_status(const TodoTable *t, int id) {
+    if (id < 1 || (size_t)id > t->count) return STATUS_TODO;
+    return (TodoStatus)t->status[id - 1];
+}
+
+const char *todotable_text(const TodoTable *t, int id, size_t *len) {
+    if (id < 1 || (size_t)id > t->count) return NULL;
+    *len = t->text_off[id] - t->text_off[id - 1];
+    return t->blob + t->text_off[id - 1];
+}
+
+int todotable_set_status(TodoTable *t, int id, TodoStatus status) {
+    if (id < 1 || (size_t)id > t->count) return -1;
+    t->status[id - 1] = (uint8_t)status;
+    return 0;
+}
+
+int todotable_get(const TodoTable *t, int id, Todo *todo) {
+    size_t len;
+    const char *text = todotable_text(t, id, &len);
+    if (!text) return -1;
+
+    todo->id = id;
+    todo->status = (TodoStatus)t->status[id - 1];
+    todo->text = (char *)text;
+    todo->text_len = len;
+    todo->raw_line = (char *)text;
+    todo->raw_len = len;
+    return 0;
+}
+
+/* Plain byte loops over the status column; the compiler vectorizes them */
+size_t todotable_count_status(const TodoTable *t, TodoStatus status) {
+    const uint8_t want = (uint8_t)status;
+    size_t n = 0;
+
+    for (size_t i = 0; i < t->count; i++) n += t->status[i] == want;
+    return n;
+}
+
+size_t todotable_select(const TodoTable *t, unsigned mask, int *ids) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < t->count; i++) {
+        ids[n] = (int)i + 1;
+        n += (mask >> t->status[i]) & 1;
     }
-    return NULL;
+    return n;
 }
 
 char status_to_char(TodoStatus status) {
@@ -212,21 +1028,34 @@ TodoStatus status_from_str(const char *str) {
 
 void todo_print(Todo *todo, FILE *out) {
     if (!todo || !todo->text) return;
-    fprintf(out, "%d\t[%c] %s\n", todo->id, status_to_char(todo->status), todo->text);
+
+    /* One line needs no Sink, whose buffer is too big for a small stack */
+    char head[32];
+    char *p = numbered_head(todo, head + sizeof(head));
+    fwrite(p, 1, (size_t)(head + sizeof(head) - p), out);
+    fwrite(todo->text, 1, todo->text_len, out);
+    putc('\n', out);
 }
 
-void todolist_print(TodoList *list, FILE *out) {
+static void print_where(TodoList *list, FILE *out, int any, TodoStatus status) {
+    Sink *sink = malloc(sizeof(Sink));
+    if (!sink) return;
+    sink_init_file(sink, out);
+
     for (size_t i = 0; i < list->count; i++) {
-        if (list->items[i].text) {
-            todo_print(&list->items[i], out);
+        if (list->items[i].text && (any || list->items[i].status == status)) {
+            sink_todo_numbered(sink, &list->items[i]);
         }
     }
+
+    sink_flush(sink);
+    free(sink);
+}
+
+void todolist_print(TodoList *list, FILE *out) {
+    print_where(list, out, 1, STATUS_TODO);
 }
 
 void todolist_print_filtered(TodoList *list, FILE *out, TodoStatus status) {
-    for (size_t i = 0; i < list->count; i++) {
-        if (list->items[i].text && list->items[i].status == status) {
-            todo_print(&list->items[i], out);
-        }
-    }
+    print_where(list, out, 0, status);
 }
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef enum {
     STATUS_TODO,
@@ -11,29 +12,251 @@ typedef enum {
     STATUS_IN_PROGRESS
 } TodoStatus;
 
+/* text and raw_line are not necessarily NUL-terminated: they may be views
+ * into a larger buffer such as a mapped file. Always use the lengths. */
 typedef struct {
     int id;
     TodoStatus status;
     char *text;
     char *raw_line;
+    size_t text_len;
+    size_t raw_len;     /* includes the line terminator, if any */
 } Todo;
 
+/* Bump allocator. Strings are carved out of large blocks and released all
+ * at once, so a list costs a handful of allocations instead of two per line. */
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock *head;
+} Arena;
+
+/* Interned strings: each distinct string is stored once and known by a
+ * small id, counting from 0, so comparing or grouping by it is integer
+ * work. Names are NUL-terminated. */
+typedef struct {
+    Arena arena;        /* owns the names */
+    const char **names;
+    uint32_t *lens;
+    size_t count;
+    size_t cap;
+    uint32_t *slots;    /* open addressing: id + 1, 0 for empty */
+    size_t mask;
+} Dict;
+
+/* Label ids, appended item after item. ids may start out as caller storage
+ * such as a stack array (heap 0); it moves to the heap once it fills up. */
+typedef struct {
+    uint32_t *ids;
+    size_t count;
+    size_t cap;
+    int heap;
+} LabelBuf;
+
+/* Inline metadata of an item: #tag and @owner words (labels) and a due
+ * date. Labels are kept with the sigil ("#ops", "@alice") as ids in a
+ * Dict, in text order without repeats, at ids[first] up to first + count
+ * of a LabelBuf. */
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+    int32_t due;        /* first due:YYYY-MM-DD as YYYYMMDD, 0 if none */
+    int32_t due_id;     /* that date's id in the Dict, -1 if none */
+} TodoMeta;
+
 typedef struct {
     Todo *items;
+    TodoMeta *meta; /* metadata of each of items */
     size_t count;
     size_t capacity;
+    Arena arena;    /* owns every text and raw_line in items */
+    size_t *index;  /* items position of each id, indexed by id - 1 */
+    size_t index_cap;
+    int next_id;    /* id the next added todo gets */
+    Dict names;     /* every label and due date seen */
+    LabelBuf labels;
 } TodoList;
 
-/* Parsing */
+/* Arena */
+void arena_init(Arena *arena);
+void *arena_alloc(Arena *arena, size_t size);  /* unaligned, for byte data */
+char *arena_strndup(Arena *arena, const char *s, size_t len);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+/* Dict */
+void dict_init(Dict *d);
+void dict_free(Dict *d);
+/* Id of s, adding it if it is new; -1 when out of memory */
+int dict_intern(Dict *d, const char *s, size_t len);
+/* Id of s, -1 if it was never interned */
+int dict_find(const Dict *d, const char *s, size_t len);
+const char *dict_name(const Dict *d, int id, size_t *len);
+
+/* Chunked line reader over a file descriptor. Lines of any length come back
+ * whole; the buffer only grows when a single line outgrows it. */
+typedef struct {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t start;   /* first byte of the next line */
+    size_t scan;    /* bytes before this are known to hold no newline */
+    size_t end;     /* end of buffered data */
+    int eof;
+    size_t nl[64];  /* newline offsets found by the last vector scan */
+    size_t nl_next;
+    size_t nl_count;
+} LineReader;
+
+/* Line reading */
+int linereader_init(LineReader *r, int fd);
+void linereader_free(LineReader *r);
+/* 1 with a line (terminator included, valid until the next call), 0 at
+ * end of input, -1 on error */
+int linereader_next(LineReader *r, const char **line, size_t *len);
+int linereader_pending(const LineReader *r);
+
+/* Buffered output. Records are assembled in a large user-space buffer and
+ * handed to the kernel (or to a FILE) in one piece when it fills or on
+ * flush, instead of one formatted write per line. */
+#define SINK_BUFSIZE (64 * 1024)
+
+typedef struct {
+    int fd;         /* target descriptor, or -1 to write through fp */
+    FILE *fp;
+    size_t len;
+    int err;        /* errno of the first failed write, 0 if none */
+    char buf[SINK_BUFSIZE];
+} Sink;
+
+/* Output sink */
+void sink_init_fd(Sink *s, int fd);
+void sink_init_file(Sink *s, FILE *fp);
+int sink_write(Sink *s, const void *data, size_t len);
+int sink_todo(Sink *s, const Todo *todo);   /* "- [c] text\n" */
+int sink_flush(Sink *s);
+
+/* Parsing. There is one set of rules for the library and the CLI: a line
+ * is "- [c] text" with any of the -, * and + bullets, a bullet without a
+ * status, or plain text; [x]/[X] is done, [>] in progress and anything
+ * else todo. Blank lines are not todos. */
+
+/* Parse one line (terminator included, not NUL-terminated) into todo.
+ * text and raw_line are views into line. A blank line leaves text NULL
+ * and id 0; anything else becomes a todo with the given id. */
+void todo_parse(const char *line, size_t len, Todo *todo, int id);
+/* Same decision as todo_parse, without extracting text: 1 and the status
+ * for a todo, 0 for a blank line */
+int todo_classify(const char *line, size_t len, TodoStatus *status);
+
+/* Metadata words in item text. A word starts the text or follows a blank
+ * or '('. #name is a tag and @name an owner, where a name is letters,
+ * digits, non-ASCII bytes and "-_/." and does not end in '.';
+ * due:YYYY-MM-DD is a due date. */
+typedef enum {
+    META_TAG,
+    META_OWNER,
+    META_DUE
+} MetaKind;
+
+typedef struct {
+    MetaKind kind;
+    const char *name;   /* "#tag" or "@owner" with the sigil, or "YYYY-MM-DD" */
+    size_t len;
+    int32_t due;        /* META_DUE: the date as YYYYMMDD */
+} MetaToken;
+
+/* Find the next metadata word in text[*pos, len) and move *pos past it.
+ * 1 with a token, 0 when there are no more. */
+int todo_meta_next(const char *text, size_t len, size_t *pos, MetaToken *tok);
+/* Exactly "YYYY-MM-DD" as YYYYMMDD in *due; 0 if s is not a date */
+int todo_meta_date(const char *s, size_t len, int32_t *due);
+/* Tokenize the metadata of text into meta, appending its label ids to
+ * labels. Labels and the due date are interned into names; -1 when out of
+ * memory. */
+int todo_meta_intern(Dict *names, const char *text, size_t len, LabelBuf *labels, TodoMeta *meta);
+/* The same against names that is only read, so several threads can share
+ * it: words not in names are skipped */
+int todo_meta_lookup(const Dict *names, const char *text, size_t len, LabelBuf *labels, TodoMeta *meta);
+void labelbuf_free(LabelBuf *b);
+
+/* Called for every line, blank ones included; the views only live for the
+ * duration of the call. Non-zero stops the parser and is passed back. */
+typedef int (*todo_cb)(Todo *todo, void *ctx);
+
+/* Push parser: feed bytes in chunks of any size and get each line back
+ * through cb as soon as it is complete. All state lives in the struct, so
+ * any number can run side by side. */
+typedef struct {
+    todo_cb cb;
+    void *ctx;
+    int next_id;    /* id the next todo gets */
+    char *partial;  /* start of a line still waiting for its newline */
+    size_t partial_len;
+    size_t partial_cap;
+} TodoParser;
+
+void todoparser_init(TodoParser *p, int first_id, todo_cb cb, void *ctx);
+/* 0, cb's non-zero result, or -1 when out of memory */
+int todoparser_feed(TodoParser *p, const char *data, size_t len);
+/* End of input: hand over a final line that has no newline */
+int todoparser_finish(TodoParser *p);
+/* Drop any partial line, e.g. when the input starts over */
+void todoparser_reset(TodoParser *p, int first_id);
+void todoparser_free(TodoParser *p);
+
 TodoList *todolist_new(void);
 void todolist_free(TodoList *list);
 int todolist_parse_file(TodoList *list, const char *filename);
 int todolist_write_file(TodoList *list, const char *filename);
+/* Append a copy of todo (its strings are not copied), index its id and
+ * tokenize its metadata */
+Todo *todolist_push(TodoList *list, const Todo *todo);
 
 /* Manipulation */
 int todolist_add(TodoList *list, const char *text);
 int todolist_set_status(TodoList *list, int id, TodoStatus status);
+/* Set every listed id; -1 if any of them was not found */
+int todolist_set_status_many(TodoList *list, const int *ids, size_t n, TodoStatus status);
 Todo *todolist_get(TodoList *list, int id);
+/* Labels and due date of id, the label ids at list->labels.ids + first;
+ * NULL if there is no such id */
+const TodoMeta *todolist_meta(const TodoList *list, int id);
+
+/* Compact, columnar todo storage for scan-heavy work. Statuses are packed
+ * one byte each, ids are implicit (row i is id i + 1) and all texts share
+ * one blob, so a status filter or count walks dense memory instead of a
+ * 40-byte Todo per item. Only todos are kept; raw lines are not, so
+ * writing a table back out always gives canonical lines. */
+typedef struct {
+    uint8_t *status;    /* TodoStatus of each row */
+    size_t *text_off;   /* row i's text is blob[text_off[i], text_off[i + 1]) */
+    char *blob;
+    size_t blob_len;
+    size_t blob_cap;
+    size_t count;
+    size_t cap;
+} TodoTable;
+
+void todotable_init(TodoTable *t);
+void todotable_free(TodoTable *t);
+/* Append a todo, copying its text; lines without text are skipped */
+int todotable_add(TodoTable *t, const Todo *todo);
+int todotable_parse_file(TodoTable *t, const char *filename);
+int todotable_from_list(TodoTable *t, const TodoList *list);
+
+size_t todotable_count(const TodoTable *t);
+TodoStatus todotable_status(const TodoTable *t, int id);
+/* Text of id, not NUL-terminated; NULL if there is no such id */
+const char *todotable_text(const TodoTable *t, int id, size_t *len);
+int todotable_set_status(TodoTable *t, int id, TodoStatus status);
+/* Fill todo with views of id, raw_line pointing at the text; -1 if absent */
+int todotable_get(const TodoTable *t, int id, Todo *todo);
+/* Number of rows with the given status */
+size_t todotable_count_status(const TodoTable *t, TodoStatus status);
+/* Store the ids whose status bit (1 << status) is in mask into ids, which
+ * must have room for todotable_count entries. Returns how many. */
+size_t todotable_select(const TodoTable *t, unsigned mask, int *ids);
 
 /* Output */
 void todo_print(Todo *todo, FILE *out);
@@ -0,0 +1,522 @@
+#include "expr.h"
+#include "prof.h"
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+
+/* The program works on a single boolean accumulator: tests overwrite it,
+ * NOT flips it, and the conditional jumps implement short-circuit and/or
+ * by skipping the right-hand side while leaving the accumulator alone. */
+enum {
+    OP_TRUE,
+    OP_STATUS,      /* arg: bitmask of 1 << TodoStatus */
+    OP_HAS,         /* arg: string index */
+    OP_RE,          /* arg: regex index */
+    OP_ID,          /* arg: id set index */
+    OP_LABEL,       /* arg: label set index */
+    OP_DUE,         /* arg: due range index */
+    OP_NOT,
+    OP_JF,          /* arg: target when the accumulator is false */
+    OP_JT           /* arg: target when the accumulator is true */
+};
+
+typedef struct {
+    const char *src;
+    const char *p;
+    Program *prog;
+    char *err;
+    size_t errlen;
+    int failed;
+} Parser;
+
+static void fail(Parser *ps, const char *fmt, ...) {
+    if (ps->failed) return;
+    ps->failed = 1;
+
+    int n = snprintf(ps->err, ps->errlen, "at offset %d: ", (int)(ps->p - ps->src));
+    if (n < 0 || (size_t)n >= ps->errlen) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(ps->err + n, ps->errlen - (size_t)n, fmt, ap);
+    va_end(ap);
+}
+
+static size_t emit(Parser *ps, unsigned char op, unsigned arg) {
+    Program *prog = ps->prog;
+
+    if (prog->len == prog->cap) {
+        size_t cap = prog->cap ? prog->cap * 2 : 16;
+        Insn *code = realloc(prog->code, sizeof(Insn) * cap);
+        if (!code) {
+            fail(ps, "out of memory");
+            return 0;
+        }
+        prog->code = code;
+        prog->cap = cap;
+    }
+
+    prog->code[prog->len].op = op;
+    prog->code[prog->len].arg = arg;
+    return prog->len++;
+}
+
+/* Grow one of the program's side tables by a single element */
+static void *push_slot(Parser *ps, void **table, size_t *count, size_t size) {
+    char *grown = realloc(*table, size * (*count + 1));
+    if (!grown) {
+        fail(ps, "out of memory");
+        return NULL;
+    }
+    *table = grown;
+    return grown + size * (*count)++;
+}
+
+static void skip_space(Parser *ps) {
+    while (isspace((unsigned char)*ps->p)) ps->p++;
+}
+
+static int ends_word(char c) {
+    return c == '\0' || c == '(' || c == ')' || isspace((unsigned char)c);
+}
+
+/* Consume keyword kw if it is the next whole word */
+static int keyword(Parser *ps, const char *kw) {
+    size_t n = strlen(kw);
+    if (strncmp(ps->p, kw, n) != 0 || !ends_word(ps->p[n])) return 0;
+    ps->p += n;
+    return 1;
+}
+
+static int symbol(Parser *ps, const char *sym) {
+    size_t n = strlen(sym);
+    if (strncmp(ps->p, sym, n) != 0) return 0;
+    ps->p += n;
+    return 1;
+}
+
+/* Inside quotes only \<quote> and \\ are escapes; any other backslash is
+ * literal, so regexes like re:'a\.b' read naturally */
+static int is_escape(const char *p, char quote) {
+    return p[0] == '\\' && (p[1] == quote || p[1] == '\\');
+}
+
+/* Read a term value, quoted or bare, into a fresh string */
+static char *read_value(Parser *ps, size_t *len) {
+    char quote = *ps->p;
+    const char *start;
+    size_t n = 0;
+
+    if (quote == '"' || quote == '\'') {
+        start = ++ps->p;
+        while (*ps->p && *ps->p != quote) {
+            if (is_escape(ps->p, quote)) ps->p++;
+            ps->p++;
+            n++;
+        }
+        if (*ps->p != quote) {
+            fail(ps, "unterminated string");
+            return NULL;
+        }
+        ps->p++;
+    } else {
+        start = ps->p;
+        while (!ends_word(*ps->p)) ps->p++;
+        n = (size_t)(ps->p - start);
+        if (n == 0) {
+            fail(ps, "missing value");
+            return NULL;
+        }
+    }
+
+    char *value = malloc(n + 1);
+    if (!value) {
+        fail(ps, "out of memory");
+        return NULL;
+    }
+
+    /* Copy, dropping the escaping backslashes of a quoted value */
+    size_t j = 0;
+    for (const char *q = start; j < n; q++) {
+        if ((quote == '"' || quote == '\'') && is_escape(q, quote)) q++;
+        value[j++] = *q;
+    }
+    value[n] = '\0';
+    *len = n;
+    return value;
+}
+
+static int status_bit(const char *name, size_t len) {
+    static const struct { const char *name; TodoStatus status; } names[] = {
+        { "t", STATUS_TODO }, { "todo", STATUS_TODO },
+        { "d", STATUS_DONE }, { "done", STATUS_DONE }, { "x", STATUS_DONE },
+        { "ip", STATUS_IN_PROGRESS }, { "in-progress", STATUS_IN_PROGRESS },
+        { "progress", STATUS_IN_PROGRESS },
+    };
+
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strlen(names[i].name) == len && strncmp(names[i].name, name, len) == 0) {
+            return 1 << names[i].status;
+        }
+    }
+    return 0;
+}
+
+/* tag:/owner: value: names, each with an optional sigil, as a set of
+ * label ids */
+static int parse_labels(Parser *ps, char sigil, const char *value, LabelSet *set) {
+    Program *prog = ps->prog;
+    char key[256];
+
+    set->first = (uint32_t)prog->nlabel_ids;
+    set->count = 0;
+    for (const char *s = value; ; ) {
+        const char *comma = strchr(s, ',');
+        size_t n = comma ? (size_t)(comma - s) : strlen(s);
+        if (n > 0 && *s == sigil) {
+            s++;
+            n--;
+        }
+        if (n == 0 || n >= sizeof(key) - 1) {
+            fail(ps, n ? "name too long" : "missing name");
+            return -1;
+        }
+
+        key[0] = sigil;
+        memcpy(key + 1, s, n);
+        int id = dict_intern(&prog->labels, key, n + 1);
+        if (id < 0) {
+            fail(ps, "out of memory");
+            return -1;
+        }
+        uint32_t *slot = push_slot(ps, (void **)&prog->label_ids, &prog->nlabel_ids, sizeof(uint32_t));
+        if (!slot) return -1;
+        *slot = (uint32_t)id;
+        set->count++;
+        if (!comma) return 0;
+        s = comma + 1;
+    }
+}
+
+/* due: value: DATE, DATE.., ..DATE or DATE..DATE */
+static int parse_due(Parser *ps, const char *value, DueRange *range) {
+    const char *dots = strstr(value, "..");
+    size_t lo_len = dots ? (size_t)(dots - value) : strlen(value);
+    const char *hi = dots ? dots + 2 : value;
+
+    range->lo = 0;
+    range->hi = INT32_MAX;
+    if ((lo_len > 0 && !todo_meta_date(value, lo_len, &range->lo)) ||
+        (*hi && !todo_meta_date(hi, strlen(hi), &range->hi)) ||
+        (dots && lo_len == 0 && !*hi)) {
+        fail(ps, "bad due date '%s', expected YYYY-MM-DD with an optional ..", value);
+        return -1;
+    }
+    return 0;
+}
+
+static void parse_term(Parser *ps) {
+    Program *prog = ps->prog;
+    const char *key = ps->p;
+
+    while (isalpha((unsigned char)*ps->p)) ps->p++;
+    size_t key_len = (size_t)(ps->p - key);
+    if (key_len == 0 || *ps->p != ':') {
+        ps->p = key;
+        fail(ps, "expected is:, has:, re:, id:, tag:, owner:, due:, 'not' or '('");
+        return;
+    }
+    ps->p++;
+
+    size_t len;
+    char *value = read_value(ps, &len);
+    if (!value) return;
+
+    if (key_len == 2 && strncmp(key, "is", 2) == 0) {
+        unsigned mask = 0;
+        for (const char *s = value; ; ) {
+            const char *comma = strchr(s, ',');
+            size_t n = comma ? (size_t)(comma - s) : strlen(s);
+            int bit = status_bit(s, n);
+            if (!bit) {
+                fail(ps, "unknown status '%.*s'", (int)n, s);
+                break;
+            }
+            mask |= (unsigned)bit;
+            if (!comma) break;
+            s = comma + 1;
+        }
+        emit(ps, OP_STATUS, mask);
+        free(value);
+    } else if (key_len == 3 && strncmp(key, "has", 3) == 0) {
+        size_t idx = prog->nstrings;
+        ExprString *slot = push_slot(ps, (void **)&prog->strings, &prog->nstrings, sizeof(ExprString));
+        if (!slot) {
+            free(value);
+            return;
+        }
+        slot->text = value;
+        slot->len = len;
+        emit(ps, OP_HAS, (unsigned)idx);
+    } else if (key_len == 2 && strncmp(key, "re", 2) == 0) {
+        regex_t re;
+        int rc = regcomp(&re, value, REG_EXTENDED | REG_NOSUB);
+        if (rc != 0) {
+            char msg[128];
+            regerror(rc, &re, msg, sizeof(msg));
+            fail(ps, "bad regex '%s': %s", value, msg);
+            free(value);
+            return;
+        }
+        free(value);
+
+        size_t idx = prog->nregexes;
+        regex_t *slot = push_slot(ps, (void **)&prog->regexes, &prog->nregexes, sizeof(regex_t));
+        if (!slot) {
+            regfree(&re);
+            return;
+        }
+        *slot = re;
+        emit(ps, OP_RE, (unsigned)idx);
+    } else if (key_len == 2 && strncmp(key, "id", 2) == 0) {
+        IdSet set;
+        if (idset_parse(&set, value) < 0) {
+            fail(ps, "bad id list '%s'", value);
+            free(value);
+            return;
+        }
+        free(value);
+
+        size_t idx = prog->nidsets;
+        IdSet *slot = push_slot(ps, (void **)&prog->idsets, &prog->nidsets, sizeof(IdSet));
+        if (!slot) {
+            idset_free(&set);
+            return;
+        }
+        *slot = set;
+        prog->uses_ids = 1;
+        emit(ps, OP_ID, (unsigned)idx);
+    } else if ((key_len == 3 && strncmp(key, "tag", 3) == 0) ||
+               (key_len == 5 && strncmp(key, "owner", 5) == 0)) {
+        LabelSet set;
+        int rc = parse_labels(ps, key_len == 3 ? '#' : '@', value, &set);
+        free(value);
+        if (rc < 0) return;
+
+        size_t idx = prog->nlabel_sets;
+        LabelSet *slot = push_slot(ps, (void **)&prog->label_sets, &prog->nlabel_sets, sizeof(LabelSet));
+        if (!slot) return;
+        *slot = set;
+        emit(ps, OP_LABEL, (unsigned)idx);
+    } else if (key_len == 3 && strncmp(key, "due", 3) == 0) {
+        DueRange range;
+        int rc = parse_due(ps, value, &range);
+        free(value);
+        if (rc < 0) return;
+
+        size_t idx = prog->ndues;
+        DueRange *slot = push_slot(ps, (void **)&prog->dues, &prog->ndues, sizeof(DueRange));
+        if (!slot) return;
+        *slot = range;
+        emit(ps, OP_DUE, (unsigned)idx);
+    } else {
+        ps->p = key;
+        fail(ps, "unknown test '%.*s:'", (int)key_len, key);
+        free(value);
+    }
+}
+
+static void parse_or(Parser *ps);
+
+static void parse_unary(Parser *ps) {
+    skip_space(ps);
+
+    if (keyword(ps, "not") || symbol(ps, "!")) {
+        parse_unary(ps);
+        emit(ps, OP_NOT, 0);
+    } else if (symbol(ps, "(")) {
+        parse_or(ps);
+        skip_space(ps);
+        if (!symbol(ps, ")")) fail(ps, "expected ')'");
+    } else {
+        parse_term(ps);
+    }
+}
+
+/* Does another operand follow, making this an implicit "and"? */
+static int starts_unary(Parser *ps) {
+    char c = *ps->p;
+    if (c == '\0' || c == ')' || strncmp(ps->p, "||", 2) == 0) return 0;
+
+    const char *save = ps->p;
+    int is_or = keyword(ps, "or");
+    ps->p = save;
+    return !is_or;
+}
+
+static void parse_and(Parser *ps) {
+    parse_unary(ps);
+
+    for (;;) {
+        skip_space(ps);
+        if (!(keyword(ps, "and") || symbol(ps, "&&") || starts_unary(ps))) break;
+        if (ps->failed) return;
+
+        size_t jump = emit(ps, OP_JF, 0);
+        parse_unary(ps);
+        if (ps->failed) return;
+        ps->prog->code[jump].arg = (unsigned)ps->prog->len;
+    }
+}
+
+static void parse_or(Parser *ps) {
+    parse_and(ps);
+
+    for (;;) {
+        skip_space(ps);
+        if (!(keyword(ps, "or") || symbol(ps, "||"))) break;
+        if (ps->failed) return;
+
+        size_t jump = emit(ps, OP_JT, 0);
+        parse_and(ps);
+        if (ps->failed) return;
+        ps->prog->code[jump].arg = (unsigned)ps->prog->len;
+    }
+}
+
+int expr_compile(Program *prog, const char *src, char *err, size_t errlen) {
+    Parser ps = { src, src, prog, err, errlen, 0 };
+
+    memset(prog, 0, sizeof(*prog));
+    dict_init(&prog->labels);
+    skip_space(&ps);
+    if (*ps.p == '\0') {
+        emit(&ps, OP_TRUE, 0);
+        return ps.failed ? -1 : 0;
+    }
+
+    parse_or(&ps);
+    skip_space(&ps);
+    if (!ps.failed && *ps.p != '\0') fail(&ps, "unexpected '%c'", *ps.p);
+
+    if (ps.failed) {
+        expr_free(prog);
+        return -1;
+    }
+    return 0;
+}
+
+/* The program's names an item has and its due date, worked out on the
+ * first test that needs them */
+typedef struct {
+    int ready;
+    TodoMeta meta;
+    LabelBuf labels;
+    uint32_t ids[8];    /* where labels starts out */
+} ItemMeta;
+
+static const TodoMeta *item_meta(const Program *prog, const Todo *todo, ItemMeta *m) {
+    if (!m->ready) {
+        m->ready = 1;
+        m->labels.ids = m->ids;
+        m->labels.count = 0;
+        m->labels.cap = sizeof(m->ids) / sizeof(m->ids[0]);
+        m->labels.heap = 0;
+        /* Out of memory leaves the labels found so far */
+        todo_meta_lookup(&prog->labels, todo->text, todo->text_len, &m->labels, &m->meta);
+    }
+    return &m->meta;
+}
+
+static int item_has_label(const Program *prog, const ItemMeta *m, const LabelSet *set) {
+    const uint32_t *ids = prog->label_ids + set->first;
+    for (size_t i = 0; i < m->labels.count; i++) {
+        for (uint32_t j = 0; j < set->count; j++) {
+            if (m->labels.ids[i] == ids[j]) return 1;
+        }
+    }
+    return 0;
+}
+
+static int run(const Program *prog, const Todo *todo) {
+    const Insn *code = prog->code;
+    ItemMeta meta;
+    const DueRange *range;
+    int32_t due;
+    int acc = 1;
+    size_t pc = 0;
+
+    meta.ready = 0;
+    while (pc < prog->len) {
+        const Insn *in = &code[pc++];
+        switch (in->op) {
+            case OP_TRUE:
+                acc = 1;
+                break;
+            case OP_STATUS:
+                acc = (in->arg >> todo->status) & 1;
+                break;
+            case OP_HAS:
+                acc = text_contains(todo->text, todo->text_len,
+                                    prog->strings[in->arg].text, prog->strings[in->arg].len);
+                break;
+            case OP_RE:
+                acc = text_regex(&prog->regexes[in->arg], todo->text, todo->text_len);
+                break;
+            case OP_ID:
+                acc = idset_contains(&prog->idsets[in->arg], todo->id);
+                break;
+            case OP_LABEL:
+                item_meta(prog, todo, &meta);
+                acc = item_has_label(prog, &meta, &prog->label_sets[in->arg]);
+                break;
+            case OP_DUE:
+                due = item_meta(prog, todo, &meta)->due;
+                range = &prog->dues[in->arg];
+                acc = due != 0 && due >= range->lo && due <= range->hi;
+                break;
+            case OP_NOT:
+                acc = !acc;
+                break;
+            case OP_JF:
+                if (!acc) pc = in->arg;
+                break;
+            case OP_JT:
+                if (acc) pc = in->arg;
+                break;
+        }
+    }
+
+    if (meta.ready) labelbuf_free(&meta.labels);
+    return acc;
+}
+
+int expr_match(const Program *prog, const Todo *todo) {
+    PROF_BEGIN(t);
+    int acc = run(prog, todo);
+    PROF_END(PHASE_FILTER, t);
+    return acc;
+}
+
+int expr_is_trivial(const Program *prog) {
+    return prog->len == 1 && prog->code[0].op == OP_TRUE;
+}
+
+int expr_needs_text(const Program *prog) {
+    return prog->nstrings > 0 || prog->nregexes > 0 || prog->nlabel_sets > 0 || prog->ndues > 0;
+}
+
+void expr_free(Program *prog) {
+    for (size_t i = 0; i < prog->nstrings; i++) free(prog->strings[i].text);
+    for (size_t i = 0; i < prog->nregexes; i++) regfree(&prog->regexes[i]);
+    for (size_t i = 0; i < prog->nidsets; i++) idset_free(&prog->idsets[i]);
+    free(prog->strings);
+    free(prog->regexes);
+    free(prog->idsets);
+    free(prog->label_ids);
+    free(prog->label_sets);
+    free(prog->dues);
+    dict_free(&prog->labels);
+    free(prog->code);
+    memset(prog, 0, sizeof(*prog));
+}
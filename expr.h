@@ -0,0 +1,80 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include "chop.h"
+#include "match.h"
+
+/* Filter expressions, compiled once into a small accumulator program and
+ * run per item. Grammar:
+ *
+ *   expr    := and { ("or" | "||") and }
+ *   and     := unary { ["and" | "&&"] unary }     (juxtaposition is "and")
+ *   unary   := ("not" | "!") unary | "(" expr ")" | term
+ *   term    := "is:" STATUS{,STATUS}    status is one of the listed
+ *            | "has:" STRING            text contains STRING
+ *            | "re:" STRING             text matches extended regex
+ *            | "id:" LIST               id in LIST, e.g. 3,7,100-250
+ *            | "tag:" NAME{,NAME}       text has one of the #tags
+ *            | "owner:" NAME{,NAME}     text has one of the @owners
+ *            | "due:" RANGE             due date is DATE, DATE.., ..DATE
+ *                                       or DATE..DATE (YYYY-MM-DD)
+ *
+ * STRING may be quoted with '...' or "..." (backslash escapes the quote).
+ * "and" and "or" short-circuit, so cheap tests placed first save the
+ * expensive ones. Tag and owner names (the # or @ is optional) are
+ * interned when compiling; an item's metadata is tokenized once, on the
+ * first test that needs it, into the ids of those names it has, so the
+ * tests themselves are integer compares. */
+
+typedef struct {
+    unsigned char op;
+    unsigned arg;
+} Insn;
+
+typedef struct {
+    char *text;
+    size_t len;
+} ExprString;
+
+typedef struct {
+    int32_t lo;         /* YYYYMMDD, inclusive */
+    int32_t hi;
+} DueRange;
+
+/* The names of one tag: or owner: test */
+typedef struct {
+    uint32_t first;     /* label_ids[first] up to first + count */
+    uint32_t count;
+} LabelSet;
+
+typedef struct {
+    Insn *code;
+    size_t len;
+    size_t cap;
+    ExprString *strings;
+    size_t nstrings;
+    regex_t *regexes;
+    size_t nregexes;
+    IdSet *idsets;
+    size_t nidsets;
+    int uses_ids;       /* result depends on item ids */
+    Dict labels;        /* "#tag" and "@owner" names tested for */
+    uint32_t *label_ids;    /* ids in labels, set after set */
+    size_t nlabel_ids;
+    LabelSet *label_sets;
+    size_t nlabel_sets;
+    DueRange *dues;
+    size_t ndues;
+} Program;
+
+/* An empty or all-blank source compiles to a program that matches
+ * everything. On error, -1 with a message in err. */
+int expr_compile(Program *prog, const char *src, char *err, size_t errlen);
+int expr_match(const Program *prog, const Todo *todo);
+/* True if the program matches every item without looking at it */
+int expr_is_trivial(const Program *prog);
+/* True if the program looks at item text (has:, re:, tag:, owner: or due:) */
+int expr_needs_text(const Program *prog);
+void expr_free(Program *prog);
+
+#endif
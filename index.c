@@ -0,0 +1,186 @@
+#include "index.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define INDEX_MAGIC "CHOPIDX2"
+
+/* On-disk layout: this header followed by count entries */
+typedef struct {
+    char magic[8];
+    uint64_t covered;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t hash;
+    uint64_t count;
+} IndexHeader;
+
+char *index_path(const char *path) {
+    const char *slash = strrchr(path, '/');
+    size_t dir_len = slash ? (size_t)(slash - path) + 1 : 0;
+    const char *base = path + dir_len;
+    char *out = malloc(dir_len + strlen(base) + sizeof("..chopidx"));
+
+    if (!out) return NULL;
+    sprintf(out, "%.*s.%s.chopidx", (int)dir_len, path, base);
+    return out;
+}
+
+void index_init(TodoIndex *idx) {
+    memset(idx, 0, sizeof(*idx));
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int index_load(TodoIndex *idx, const char *path) {
+    IndexHeader h;
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    index_clear(idx);
+    if (fd < 0) return -1;
+
+    /* The size must match the entry count exactly */
+    if (fstat(fd, &st) < 0 || read_all(fd, &h, sizeof(h)) < 0 ||
+        memcmp(h.magic, INDEX_MAGIC, 8) != 0 ||
+        h.count > (uint64_t)(SIZE_MAX / sizeof(IndexEntry)) ||
+        (uint64_t)st.st_size != sizeof(h) + h.count * sizeof(IndexEntry)) {
+        close(fd);
+        return -1;
+    }
+
+    if (h.count > idx->cap) {
+        IndexEntry *entries = realloc(idx->entries, sizeof(IndexEntry) * h.count);
+        if (!entries) {
+            close(fd);
+            return -1;
+        }
+        idx->entries = entries;
+        idx->cap = h.count;
+    }
+
+    if (read_all(fd, idx->entries, sizeof(IndexEntry) * h.count) < 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    idx->covered = h.covered;
+    idx->size = h.size;
+    idx->mtime_sec = h.mtime_sec;
+    idx->mtime_nsec = h.mtime_nsec;
+    idx->dev = h.dev;
+    idx->ino = h.ino;
+    idx->hash = h.hash;
+    idx->count = h.count;
+    return 0;
+}
+
+int index_save(const TodoIndex *idx, const char *path) {
+    IndexHeader h;
+    char *tmp = malloc(strlen(path) + sizeof(".XXXXXX"));
+
+    if (!tmp) return -1;
+    sprintf(tmp, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0) {
+        free(tmp);
+        return -1;
+    }
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, INDEX_MAGIC, 8);
+    h.covered = idx->covered;
+    h.size = idx->size;
+    h.mtime_sec = idx->mtime_sec;
+    h.mtime_nsec = idx->mtime_nsec;
+    h.dev = idx->dev;
+    h.ino = idx->ino;
+    h.hash = idx->hash;
+    h.count = idx->count;
+
+    int rc = 0;
+    if (write_all(fd, &h, sizeof(h)) < 0 ||
+        write_all(fd, idx->entries, sizeof(IndexEntry) * idx->count) < 0) {
+        rc = -1;
+    }
+    if (close(fd) < 0) rc = -1;
+    if (rc == 0 && rename(tmp, path) < 0) rc = -1;
+    if (rc < 0) unlink(tmp);
+    free(tmp);
+    return rc;
+}
+
+int index_push(TodoIndex *idx, const IndexEntry *entry) {
+    if (idx->count == idx->cap) {
+        size_t cap = idx->cap ? idx->cap * 2 : 1024;
+        IndexEntry *entries = realloc(idx->entries, sizeof(IndexEntry) * cap);
+        if (!entries) return -1;
+        idx->entries = entries;
+        idx->cap = cap;
+    }
+    idx->entries[idx->count++] = *entry;
+    return 0;
+}
+
+void index_clear(TodoIndex *idx) {
+    idx->covered = 0;
+    idx->count = 0;
+    idx->hash = 0;
+}
+
+void index_free(TodoIndex *idx) {
+    free(idx->entries);
+    index_init(idx);
+}
+
+/* One multiply and shift per 8 bytes, so checking the indexed part of a
+ * file costs a small fraction of parsing it again */
+uint64_t index_hash(const char *p, size_t n) {
+    const uint64_t k = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = k ^ n;
+    uint64_t w;
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * k;
+        h ^= h >> 32;
+    }
+    if (i < n) {
+        w = 0;
+        memcpy(&w, p + i, n - i);
+        h = (h ^ w) * k;
+        h ^= h >> 32;
+    }
+    return h ^ (h >> 29);
+}
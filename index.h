@@ -0,0 +1,50 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sidecar index for a todo file: where each todo's line and text start and
+ * what its status is, so a later run can skip parsing the lines it has
+ * already seen. Ids are implicit, entry i being todo i + 1. The file is a
+ * cache in native byte order; anything unexpected in it means rebuild. */
+
+typedef struct {
+    uint64_t offset;    /* line start in the file */
+    uint32_t raw_len;   /* including the newline */
+    uint32_t text_off;  /* text start, relative to offset */
+    uint32_t text_len;
+    uint32_t status;
+} IndexEntry;
+
+typedef struct {
+    uint64_t covered;   /* bytes described, always ending after a newline */
+    uint64_t size;      /* file size and mtime when last synced */
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t dev;       /* with ino, which file was indexed */
+    uint64_t ino;
+    uint64_t hash;      /* index_hash of the covered bytes */
+    IndexEntry *entries;
+    size_t count;
+    size_t cap;
+} TodoIndex;
+
+/* Sidecar file name for path: ".NAME.chopidx" in the same directory.
+ * Returns a malloc'd string, NULL on allocation failure. */
+char *index_path(const char *path);
+
+void index_init(TodoIndex *idx);
+/* -1 when the sidecar is missing or not a valid index */
+int index_load(TodoIndex *idx, const char *path);
+/* Written to a temp file and renamed into place */
+int index_save(const TodoIndex *idx, const char *path);
+int index_push(TodoIndex *idx, const IndexEntry *entry);
+/* Drop every entry, keeping the allocation */
+void index_clear(TodoIndex *idx);
+void index_free(TodoIndex *idx);
+
+/* Fast non-cryptographic hash used to tell whether indexed bytes changed */
+uint64_t index_hash(const char *p, size_t n);
+
+#endif
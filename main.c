@@ -1,21 +1,76 @@
+/* realpath(3) is XSI; SO_PEERCRED's struct ucred is GNU */
+#define _XOPEN_SOURCE 700
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
 #include "chop.h"
+#include "scan.h"
+#include "expr.h"
+#include "index.h"
+#include "prof.h"
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 #ifndef VERSION
 #define VERSION "devel"
 #endif
 
+#ifndef __linux__
+/* BSD and macOS have it but hide it under the POSIX feature macros */
+int getpeereid(int fd, uid_t *uid, gid_t *gid);
+#endif
+
 static void usage(const char *prog) {
     fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "       %s [options] FILE|DIR...\n", prog);
     fprintf(stderr, "\nStream filter for todo lists. Reads stdin, writes stdout.\n");
     fprintf(stderr, "\nOptions:\n");
     fprintf(stderr, "  --include=STATUS  Include only STATUS (todo, done, in-progress)\n");
     fprintf(stderr, "  --exclude=STATUS  Exclude STATUS (todo, done, in-progress)\n");
     fprintf(stderr, "  --mark=STATUS     Mark all with status (todo, done, in-progress)\n");
     fprintf(stderr, "  --fzf             With --mark: select interactively\n");
+    fprintf(stderr, "  --id=LIST         Only items with these ids, e.g. 3,7,100-250\n");
+    fprintf(stderr, "  --match=TEXT      Only items whose text contains TEXT\n");
+    fprintf(stderr, "  --regex=RE        Only items whose text matches extended regex RE\n");
+    fprintf(stderr, "  --tag=NAMES       Only items with one of these #tags, e.g. ops,infra\n");
+    fprintf(stderr, "  --owner=NAMES     Only items with one of these @owners\n");
+    fprintf(stderr, "  --due=RANGE       Only items due in RANGE, e.g. ..2026-10-20\n");
+    fprintf(stderr, "  -e, --where=EXPR  Only items matching EXPR, e.g. 'not is:done has:#ops'\n");
     fprintf(stderr, "  -f, --file=FILE   Read from FILE instead of stdin\n");
     fprintf(stderr, "  -w, --write       Write back to FILE (requires -f)\n");
+    fprintf(stderr, "  -j, --jobs=N      Parse a regular file with N threads (0 = all CPUs)\n");
+    fprintf(stderr, "  --index           Keep a sidecar index of FILE to skip reparsing it\n");
+    fprintf(stderr, "  -F, --follow      Keep reading FILE as it grows, like tail -f\n");
+    fprintf(stderr, "  --name=GLOB       In directories, only take files whose name matches GLOB\n");
+    fprintf(stderr, "  --uniq            Drop repeated items, keeping the first (done > in-progress > todo)\n");
+    fprintf(stderr, "  --sort=KEY        Order output by status, text or id\n");
+    fprintf(stderr, "  --group-by=KEY    List (or --count) items under each tag, owner or due date\n");
+    fprintf(stderr, "  --limit=N         Stop after printing N items (--head=N is the same)\n");
+    fprintf(stderr, "  --offset=M        Skip the first M matching items\n");
+    fprintf(stderr, "  --count           Print how many items match instead of the items\n");
+    fprintf(stderr, "  --stats[=json]    Print matching items per status, as text or JSON\n");
+    fprintf(stderr, "  --diff A B        Show items added (+), removed (-) or changed (~) from A to B\n");
+    fprintf(stderr, "  --merge BASE OURS THEIRS  Merge two edits of BASE; -w writes into OURS\n");
+    fprintf(stderr, "  --serve           Keep files parsed in memory and answer other chops\n");
+    fprintf(stderr, "  --profile         On exit, print hot-path counters and timings to stderr\n");
     fprintf(stderr, "  -v, --version     Show version\n");
     fprintf(stderr, "  -h, --help        Show this help message\n");
     fprintf(stderr, "\nShort forms:\n");
@@ -27,229 +82,2825 @@ static void usage(const char *prog) {
     fprintf(stderr, "  cat todos.txt | %s -it            # include pending only\n", prog);
     fprintf(stderr, "  cat todos.txt | %s -xd            # exclude done (clear finished)\n", prog);
     fprintf(stderr, "  cat todos.txt | %s -md | sponge todos.txt  # mark all done\n", prog);
+    fprintf(stderr, "  %s -f todos.txt -md --id=3,7 -w    # mark items 3 and 7 done\n", prog);
+    fprintf(stderr, "  %s -f todos.txt -e 'is:todo,ip (has:#ops or re:^deploy)'\n", prog);
     fprintf(stderr, "  %s -f todos.txt -xd -w            # clear done items in-place\n", prog);
+    fprintf(stderr, "  %s -xd -w --name='*.txt' projects/  # ... in every file under projects\n", prog);
     fprintf(stderr, "  echo \"Buy milk\" | %s >> todos.txt\n", prog);
 }
 
-/* Parse short status code: t=todo, d=done, ip=in-progress */
-static int parse_status_code(const char *code, TodoStatus *status) {
-    if (strcmp(code, "t") == 0 || strcmp(code, "todo") == 0) {
-        *status = STATUS_TODO;
-        return 0;
-    } else if (strcmp(code, "d") == 0 || strcmp(code, "done") == 0) {
-        *status = STATUS_DONE;
-        return 0;
-    } else if (strcmp(code, "ip") == 0 || strcmp(code, "in-progress") == 0) {
-        *status = STATUS_IN_PROGRESS;
-        return 0;
+/* Parse short status code: t=todo, d=done, ip=in-progress */
+static int parse_status_code(const char *code, TodoStatus *status) {
+    if (strcmp(code, "t") == 0 || strcmp(code, "todo") == 0) {
+        *status = STATUS_TODO;
+        return 0;
+    } else if (strcmp(code, "d") == 0 || strcmp(code, "done") == 0) {
+        *status = STATUS_DONE;
+        return 0;
+    } else if (strcmp(code, "ip") == 0 || strcmp(code, "in-progress") == 0) {
+        *status = STATUS_IN_PROGRESS;
+        return 0;
+    }
+    return -1;
+}
+
+/* Input source. Regular files are mapped read-only and handed out as views
+ * straight into the mapping; pipes and terminals go through a LineReader. */
+typedef struct {
+    FILE *fp;
+    const char *map;    /* whole file when mapped, NULL for buffered reads */
+    size_t map_len;
+    size_t pos;
+    int live;           /* not a regular file: data may arrive slowly */
+    LineReader reader;
+    size_t nl[64];      /* newline offsets queued by the last vector scan */
+    size_t nl_next;
+    size_t nl_count;
+    const TodoIndex *index;     /* describes the mapping up to index->covered */
+    const char *follow;         /* keep reading this file as it grows */
+    const TodoList *list;       /* parsed todos held by --serve; replaces the rest */
+} Input;
+
+static int input_open(Input *in, FILE *fp) {
+    struct stat st;
+    int fd = fileno(fp);
+
+    memset(in, 0, sizeof(*in));
+    in->fp = fp;
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        in->live = 1;
+        return linereader_init(&in->reader, fd);
+    }
+
+    /* Honour the current offset so "chop < file" after a partial read works */
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0 || start >= st.st_size) return linereader_init(&in->reader, fd);
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return linereader_init(&in->reader, fd);
+
+    posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+    in->map = map;
+    in->map_len = (size_t)st.st_size;
+    in->pos = (size_t)start;
+    PROF_COUNT(PROF_BYTES_IN, in->map_len - in->pos);
+    return 0;
+}
+
+static void input_close(Input *in) {
+    if (in->map) {
+        munmap((void *)in->map, in->map_len);
+        /* Leave the descriptor where a buffered reader would have */
+        lseek(fileno(in->fp), 0, SEEK_END);
+    }
+    in->map = NULL;
+    linereader_free(&in->reader);
+}
+
+/* Next line including its terminator. The view stays valid until the next
+ * call for buffered input, and until input_close for mapped input. */
+static int input_next(Input *in, const char **line, size_t *len) {
+    if (in->map) {
+        if (in->pos >= in->map_len) return 0;
+
+        if (in->nl_next == in->nl_count) {
+            PROF_BEGIN(t);
+            size_t max = sizeof(in->nl) / sizeof(in->nl[0]);
+            in->nl_count = scan_newlines(in->map + in->pos, in->map_len - in->pos, in->nl, max);
+            for (size_t i = 0; i < in->nl_count; i++) in->nl[i] += in->pos;
+            in->nl_next = 0;
+            PROF_END(PHASE_READ, t);
+        }
+
+        /* No newline left means a final unterminated line */
+        size_t end = in->nl_next < in->nl_count ? in->nl[in->nl_next++] + 1 : in->map_len;
+        *line = in->map + in->pos;
+        *len = end - in->pos;
+        in->pos = end;
+        return 1;
+    }
+
+    return linereader_next(&in->reader, line, len) > 0;
+}
+
+/* True when the next line has not arrived yet, i.e. the next read may block */
+static int input_idle(Input *in) {
+    return !in->map && !linereader_pending(&in->reader);
+}
+
+/* Filter options collected from the command line, as one expression */
+typedef struct {
+    char *src;
+    size_t len;
+} Where;
+
+/* Append "and prefix value suffix"; with quote, value is a literal string */
+static void where_add(Where *w, const char *prefix, const char *value, int quote,
+                      const char *suffix) {
+    size_t need = w->len + strlen(prefix) + 2 * strlen(value) + strlen(suffix) + 8;
+    char *src = realloc(w->src, need);
+    if (!src) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        exit(1);
+    }
+
+    char *p = src + w->len;
+    if (w->len > 0) p += sprintf(p, " and ");
+    p += sprintf(p, "%s", prefix);
+    if (quote) {
+        *p++ = '\'';
+        for (const char *v = value; *v; v++) {
+            if (*v == '\'' || *v == '\\') *p++ = '\\';
+            *p++ = *v;
+        }
+        *p++ = '\'';
+    } else {
+        p += sprintf(p, "%s", value);
+    }
+    p += sprintf(p, "%s", suffix);
+
+    w->src = src;
+    w->len = (size_t)(p - src);
+}
+
+/* Parse a worker count; 0 means one per online CPU */
+static int parse_jobs(const char *arg, int *jobs) {
+    char *end;
+    long n = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || n < 0 || n > 1024) return -1;
+
+    if (n == 0) {
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n < 1) n = 1;
+    }
+    *jobs = (int)n;
+    return 0;
+}
+
+/* A plain decimal item count for --limit and --offset */
+static int parse_count(const char *arg, size_t *count) {
+    char *end;
+    if (*arg < '0' || *arg > '9') return -1;
+    errno = 0;
+    unsigned long long n = strtoull(arg, &end, 10);
+    if (*end != '\0' || errno || n >= SIZE_MAX) return -1;
+    *count = (size_t)n;
+    return 0;
+}
+
+/* Is the raw line byte-for-byte what emit_todo would write for it? */
+static int is_canonical(const Todo *todo) {
+    const char *raw = todo->raw_line;
+
+    return todo->text == raw + 6 && todo->raw_len == todo->text_len + 7 &&
+           raw[0] == '-' && raw[1] == ' ' && raw[2] == '[' &&
+           raw[3] == status_to_char(todo->status) &&
+           raw[4] == ']' && raw[5] == ' ' && raw[todo->raw_len - 1] == '\n';
+}
+
+/* Write one todo in canonical form. A raw line that is already canonical is
+ * copied as one piece, which for mapped input means straight from the file. */
+static void emit_todo(const Todo *todo, Sink *out) {
+    if (is_canonical(todo)) {
+        sink_write(out, todo->raw_line, todo->raw_len);
+        return;
+    }
+
+    sink_todo(out, todo);
+}
+
+/* Output all todos to a sink */
+static void output_todos(TodoList *list, Sink *out) {
+    for (size_t i = 0; i < list->count; i++) {
+        Todo *todo = &list->items[i];
+        if (todo->text) {
+            emit_todo(todo, out);
+        }
+    }
+}
+
+/* Called once per parsed todo by stream_todos; non-zero stops the stream.
+ * A callback that wants no more returns STREAM_DONE, which is not an error;
+ * one that hits an output error returns -1 so nothing more gets parsed. */
+typedef int (*todo_fn)(Todo *todo, Sink *out, void *ctx);
+
+#define STREAM_DONE 1
+
+/* Parse, handle and emit one line at a time. Memory stays constant no matter
+ * how long the input is, and output is flushed whenever the input goes quiet
+ * so interactive pipelines see each result as soon as its line arrives. */
+static int stream_from(Input *in, Sink *out, todo_fn fn, void *ctx, int *next_id) {
+    const char *line;
+    size_t len;
+    int id = *next_id;
+    int rc = 0;
+
+    while (rc == 0 && input_next(in, &line, &len)) {
+        Todo todo;
+        todo_parse(line, len, &todo, id);
+        if (todo.text) {
+            id++;
+            rc = fn(&todo, out, ctx);
+        }
+
+        if (out && in->live && input_idle(in)) sink_flush(out);
+    }
+
+    *next_id = id;
+    return rc;
+}
+
+/* Hand out the indexed todos without parsing, then go on from the first
+ * unindexed byte. Only lines a callback actually looks at get read. */
+static int stream_index(Input *in, Sink *out, todo_fn fn, void *ctx, int *next_id) {
+    const TodoIndex *idx = in->index;
+    char *base = (char *)in->map;
+    int rc = 0;
+
+    for (size_t i = 0; rc == 0 && i < idx->count; i++) {
+        const IndexEntry *e = &idx->entries[i];
+        Todo todo;
+        todo.id = (int)i + 1;
+        todo.status = (TodoStatus)e->status;
+        todo.raw_line = base + e->offset;
+        todo.raw_len = e->raw_len;
+        todo.text = todo.raw_line + e->text_off;
+        todo.text_len = e->text_len;
+        rc = fn(&todo, out, ctx);
+    }
+
+    *next_id = (int)idx->count + 1;
+    in->pos = (size_t)idx->covered;
+    return rc;
+}
+
+/* Hand out already parsed todos. Each is a copy, so callbacks may change
+ * it without touching the list. */
+static int stream_list(const TodoList *list, Sink *out, todo_fn fn, void *ctx) {
+    int rc = 0;
+
+    for (size_t i = 0; rc == 0 && i < list->count; i++) {
+        Todo todo = list->items[i];
+        if (todo.text) rc = fn(&todo, out, ctx);
+    }
+    return rc;
+}
+
+static int stream_todos(Input *in, Sink *out, todo_fn fn, void *ctx) {
+    int id = 1;
+    if (in->list) return stream_list(in->list, out, fn, ctx);
+    if (in->index) {
+        int rc = stream_index(in, out, fn, ctx, &id);
+        if (rc != 0) return rc;
+    }
+    return stream_from(in, out, fn, ctx, &id);
+}
+
+/* Read todos from an input into list. Mapped input is referenced in place,
+ * so the list must be freed before the input is closed. fn, if given, sees
+ * each todo as it is parsed, so a consumer can start before the input ends. */
+static TodoList *read_todos(Input *in, Sink *out, todo_fn fn, void *ctx) {
+    TodoList *list = todolist_new();
+    if (!list) return NULL;
+
+    const char *line;
+    size_t len;
+    int id = 1;
+    while (input_next(in, &line, &len)) {
+        /* Buffered lines are overwritten by the next read; keep a copy */
+        if (!in->map) {
+            line = arena_strndup(&list->arena, line, len);
+            if (!line) {
+                todolist_free(list);
+                return NULL;
+            }
+        }
+
+        Todo todo;
+        todo_parse(line, len, &todo, id);
+        if (todo.text) id++;
+        if (!todolist_push(list, &todo)) {
+            todolist_free(list);
+            return NULL;
+        }
+
+        if (fn && todo.text) fn(&todo, out, ctx);
+        if (out && in->live && input_idle(in)) sink_flush(out);
+    }
+
+    return list;
+}
+
+/* Follow mode: wait for the file to change. inotify sleeps until it does;
+ * elsewhere, poll once a second. */
+static int watch_open(const char *path) {
+#ifdef __linux__
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd >= 0 && inotify_add_watch(fd, path, IN_MODIFY | IN_ATTRIB) < 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+#else
+    (void)path;
+    return -1;
+#endif
+}
+
+static void watch_wait(int fd) {
+    if (fd >= 0) {
+        char buf[4096];
+        if (read(fd, buf, sizeof(buf)) >= 0) return;
+    }
+
+    struct timespec ts = { 1, 0 };
+    nanosleep(&ts, NULL);
+}
+
+/* Passes the parser's todos on to a todo_fn */
+typedef struct {
+    todo_fn fn;
+    Sink *out;
+    void *ctx;
+} Relay;
+
+static int relay_todo(Todo *todo, void *arg) {
+    Relay *r = arg;
+    return todo->text ? r->fn(todo, r->out, r->ctx) : 0;
+}
+
+/* Like tail -f: handle the file from the current offset, then every line
+ * appended to it, until it is deleted or output fails. Only complete lines
+ * are handled, and ids keep counting across appends. A truncated file is
+ * read again from the start with ids starting over. */
+static int stream_follow(Input *in, Sink *out, todo_fn fn, void *ctx) {
+    int fd = fileno(in->fp);
+    off_t offset = in->map ? (off_t)in->pos : lseek(fd, 0, SEEK_CUR);
+    char *buf = malloc(SINK_BUFSIZE);
+    Relay relay = { fn, out, ctx };
+    TodoParser parser;
+    int rc = 0;
+    int watch;
+
+    if (!buf || offset < 0 || lseek(fd, offset, SEEK_SET) < 0) {
+        free(buf);
+        return -1;
+    }
+    todoparser_init(&parser, 1, relay_todo, &relay);
+    watch = watch_open(in->follow);
+
+    while (rc == 0) {
+        PROF_BEGIN(t);
+        ssize_t n = read(fd, buf, SINK_BUFSIZE);
+        PROF_END(PHASE_READ, t);
+        PROF_COUNT(PROF_READS, 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            rc = -1;
+            break;
+        }
+
+        if (n > 0) {
+            PROF_COUNT(PROF_BYTES_IN, n);
+            offset += n;
+            rc = todoparser_feed(&parser, buf, (size_t)n);
+            continue;
+        }
+
+        /* Caught up: show what we have, then sleep until the file changes */
+        struct stat st;
+        if (sink_flush(out) < 0 || fstat(fd, &st) < 0 || st.st_nlink == 0) break;
+
+        if (st.st_size < offset) {
+            lseek(fd, 0, SEEK_SET);
+            offset = 0;
+            todoparser_reset(&parser, 1);
+            continue;
+        }
+        watch_wait(watch);
+    }
+
+    if (watch >= 0) close(watch);
+    todoparser_free(&parser);
+    free(buf);
+    return rc;
+}
+
+/* Parallel mode. A mapped input is cut at newline boundaries into chunks
+ * that a pool of workers parse and handle into private memory streams; the
+ * main thread writes finished chunks out strictly in input order. Workers
+ * may only run a bounded window ahead of the writer, which caps memory.
+ * When the callback looks at ids, a counting pass runs first so each
+ * chunk knows the id its first todo gets. */
+#define CHUNK_MIN (1024 * 1024)
+#define CHUNK_MAX (64 * 1024 * 1024)
+
+typedef struct {
+    const char *start;
+    size_t len;
+    int first_id;
+    int count;          /* todos in the chunk */
+    int rc;
+    int done;
+    char *buf;          /* output, from open_memstream */
+    size_t buf_len;
+} Chunk;
+
+typedef struct {
+    Chunk *chunks;
+    size_t n;
+    size_t next;        /* next chunk to hand out */
+    size_t written;     /* chunks the writer has finished with */
+    size_t window;      /* how far workers may run ahead of written */
+    int counting;       /* pass 1: only count todos */
+    todo_fn fn;
+    void *ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} Pool;
+
+static int count_one(Todo *todo, Sink *out, void *ctx) {
+    (void)todo;
+    (void)out;
+    (void)ctx;
+    return 0;
+}
+
+static void chunk_run(Pool *pool, Chunk *c) {
+    Input in;
+    memset(&in, 0, sizeof(in));
+    in.map = c->start;
+    in.map_len = c->len;
+
+    int id = c->first_id;
+    if (pool->counting) {
+        stream_from(&in, NULL, count_one, NULL, &id);
+        c->count = id - c->first_id;
+        return;
+    }
+
+    Sink *sink = malloc(sizeof(Sink));
+    FILE *mem = open_memstream(&c->buf, &c->buf_len);
+    if (!sink || !mem) {
+        free(sink);
+        if (mem) fclose(mem);
+        c->rc = -1;
+        return;
+    }
+
+    sink_init_file(sink, mem);
+    c->rc = stream_from(&in, sink, pool->fn, pool->ctx, &id);
+    if (sink_flush(sink) < 0) c->rc = -1;
+    free(sink);
+    if (fclose(mem) != 0) c->rc = -1;
+}
+
+static void *pool_worker(void *arg) {
+    Pool *pool = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->next < pool->n && pool->next >= pool->written + pool->window) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->next >= pool->n) {
+            pthread_mutex_unlock(&pool->lock);
+            prof_flush();
+            return NULL;
+        }
+        Chunk *c = &pool->chunks[pool->next++];
+        pthread_mutex_unlock(&pool->lock);
+
+        chunk_run(pool, c);
+
+        pthread_mutex_lock(&pool->lock);
+        c->done = 1;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* Run one pass over every chunk. With out set, chunk output is written in
+ * order as it completes; the first non-zero callback result stops it. */
+static int pool_pass(Pool *pool, pthread_t *threads, int jobs, Sink *out) {
+    int started = 0;
+    int rc = 0;
+
+    pool->next = pool->written = 0;
+    for (size_t i = 0; i < pool->n; i++) pool->chunks[i].done = 0;
+
+    for (; started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, pool_worker, pool) != 0) break;
+    }
+    if (started == 0) {
+        /* No threads to be had; do the work here */
+        pool->window = pool->n;
+        pool_worker(pool);
+    }
+
+    size_t end = pool->n;
+    for (size_t i = 0; i < end; i++) {
+        Chunk *c = &pool->chunks[i];
+
+        pthread_mutex_lock(&pool->lock);
+        while (!c->done) pthread_cond_wait(&pool->cond, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+
+        if (out && rc == 0) {
+            rc = c->rc;
+            if (sink_write(out, c->buf, c->buf_len) < 0 || out->err) rc = -1;
+        }
+        free(c->buf);
+        c->buf = NULL;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->written = i + 1;
+        /* Once stopped, skip the chunks nobody has started yet and
+         * wait only for those that have been */
+        if (rc != 0 && pool->next < pool->n) {
+            end = pool->next;
+            pool->next = pool->n;
+        }
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+    return rc;
+}
+
+static int stream_parallel(Input *in, Sink *out, todo_fn fn, void *ctx,
+                           int needs_ids, int jobs) {
+    if (in->follow) return stream_follow(in, out, fn, ctx);
+
+    size_t total = in->map ? in->map_len - in->pos : 0;
+    if (jobs <= 1 || in->index || total < 2 * CHUNK_MIN) {
+        return stream_todos(in, out, fn, ctx);
+    }
+
+    /* A few chunks per worker keeps them busy when lines are uneven */
+    size_t target = total / ((size_t)jobs * 4);
+    if (target < CHUNK_MIN) target = CHUNK_MIN;
+    if (target > CHUNK_MAX) target = CHUNK_MAX;
+
+    size_t cap = total / target + 1;
+    Chunk *chunks = calloc(cap, sizeof(Chunk));
+    pthread_t *threads = malloc(sizeof(pthread_t) * (size_t)jobs);
+    if (!chunks || !threads) {
+        free(chunks);
+        free(threads);
+        return stream_todos(in, out, fn, ctx);
+    }
+
+    size_t n = 0;
+    const char *p = in->map + in->pos;
+    const char *end = in->map + in->map_len;
+    while (p < end) {
+        size_t len = (size_t)(end - p);
+        if (len > target && n + 1 < cap) {
+            len = target + scan_newline(p + target, len - target);
+            if (len < (size_t)(end - p)) len++;
+        }
+        chunks[n].start = p;
+        chunks[n].len = len;
+        chunks[n].first_id = 1;
+        n++;
+        p += len;
+    }
+    in->pos = in->map_len;
+
+    Pool pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.chunks = chunks;
+    pool.n = n;
+    pool.fn = fn;
+    pool.ctx = ctx;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    if (needs_ids) {
+        pool.counting = 1;
+        pool.window = n;
+        pool_pass(&pool, threads, jobs, NULL);
+        int id = 1;
+        for (size_t i = 0; i < n; i++) {
+            chunks[i].first_id = id;
+            id += chunks[i].count;
+        }
+        pool.counting = 0;
+    }
+
+    pool.window = (size_t)jobs * 2;
+    int rc = pool_pass(&pool, threads, jobs, out);
+
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+    free(threads);
+    free(chunks);
+    return rc;
+}
+
+static int filter_one(Todo *todo, Sink *out, void *ctx) {
+    const Program *prog = ctx;
+    if (expr_match(prog, todo)) emit_todo(todo, out);
+    return out->err ? -1 : 0;
+}
+
+/* filter_one for a program that takes every item */
+static int format_one(Todo *todo, Sink *out, void *ctx) {
+    (void)ctx;
+    emit_todo(todo, out);
+    return out->err ? -1 : 0;
+}
+
+/* Output order for cmd_filter. SORT_ID is input order, which is also what
+ * SORT_NONE gives. */
+typedef enum {
+    SORT_NONE,
+    SORT_STATUS,
+    SORT_TEXT,
+    SORT_ID
+} SortKey;
+
+/* --group-by: each item goes under every #tag or @owner it has, or under
+ * its due date */
+typedef enum {
+    GROUP_NONE,
+    GROUP_TAG,
+    GROUP_OWNER,
+    GROUP_DUE
+} GroupKey;
+
+typedef struct {
+    int uniq;           /* drop repeated texts, merging their status */
+    SortKey sort;
+    GroupKey group;
+    size_t offset;      /* matching items to skip */
+    size_t limit;       /* most items to print, SIZE_MAX for all */
+} Order;
+
+#define ORDER_ALL { 0, SORT_NONE, GROUP_NONE, 0, SIZE_MAX }
+
+/* Status precedence for --uniq and --sort=status: a duplicate that is done
+ * anywhere is done */
+static const unsigned char status_rank[] = {
+    [STATUS_TODO] = 0,
+    [STATUS_IN_PROGRESS] = 1,
+    [STATUS_DONE] = 2,
+};
+
+/* One kept todo. Text points into the mapped input or the set's arena. */
+typedef struct {
+    const char *text;
+    uint32_t len;
+    uint8_t status;
+} Item;
+
+/* Items in insertion order, optionally keyed by text through an open
+ * addressing table: hash in the high half of a slot, item index + 1 in the
+ * low half, 0 for empty */
+typedef struct {
+    Arena arena;
+    Item *items;
+    size_t count;
+    size_t cap;
+    uint64_t *slots;
+    size_t mask;
+} ItemSet;
+
+static void itemset_init(ItemSet *s) {
+    memset(s, 0, sizeof(*s));
+    arena_init(&s->arena);
+}
+
+static void itemset_free(ItemSet *s) {
+    arena_free(&s->arena);
+    free(s->items);
+    free(s->slots);
+}
+
+static int itemset_grow(ItemSet *s) {
+    size_t size = s->slots ? (s->mask + 1) * 2 : 1024;
+    uint64_t *slots = calloc(size, sizeof(uint64_t));
+    if (!slots) return -1;
+
+    /* The stored hash half is enough to place a slot again */
+    for (size_t i = 0; s->slots && i <= s->mask; i++) {
+        uint64_t e = s->slots[i];
+        if (!e) continue;
+        size_t j = (size_t)(e >> 32) & (size - 1);
+        while (slots[j]) j = (j + 1) & (size - 1);
+        slots[j] = e;
+    }
+    free(s->slots);
+    s->slots = slots;
+    s->mask = size - 1;
+    return 0;
+}
+
+/* The slot holding text, or the empty slot where it belongs */
+static uint64_t *itemset_find(ItemSet *s, const char *text, uint32_t len, uint32_t *hash) {
+    uint32_t h = (uint32_t)(index_hash(text, len) >> 32);
+    size_t j = h & s->mask;
+
+    for (;;) {
+        uint64_t e = s->slots[j];
+        if (!e) break;
+        if ((uint32_t)(e >> 32) == h) {
+            const Item *it = &s->items[(uint32_t)e - 1];
+            if (it->len == len && memcmp(it->text, text, len) == 0) break;
+        }
+        j = (j + 1) & s->mask;
+    }
+    *hash = h;
+    return &s->slots[j];
+}
+
+/* Index of the keyed item with this text, -1 if there is none */
+static long itemset_lookup(ItemSet *s, const char *text, uint32_t len) {
+    uint32_t hash;
+    if (!s->slots) return -1;
+    return (long)(uint32_t)*itemset_find(s, text, len, &hash) - 1;
+}
+
+/* Append an item, or when keyed, find the one with the same text and
+ * only append if there is none. Returns the item's index and sets *added,
+ * -1 on failure. copy says the text is transient. */
+static long itemset_add(ItemSet *s, const char *text, size_t len, TodoStatus status,
+                        int copy, int keyed, int *added) {
+    if (len > UINT32_MAX || s->count >= UINT32_MAX - 1) return -1;
+
+    uint64_t *slot = NULL;
+    uint32_t hash = 0;
+    *added = 0;
+    if (keyed) {
+        if (s->count + 1 > (s->mask + 1) / 2 && itemset_grow(s) < 0) return -1;
+        slot = itemset_find(s, text, (uint32_t)len, &hash);
+        if (*slot) return (long)(uint32_t)*slot - 1;
+    }
+
+    if (s->count == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 1024;
+        Item *items = realloc(s->items, sizeof(Item) * cap);
+        if (!items) return -1;
+        s->items = items;
+        s->cap = cap;
+    }
+    if (copy && !(text = arena_strndup(&s->arena, text, len))) return -1;
+
+    s->items[s->count].text = text;
+    s->items[s->count].len = (uint32_t)len;
+    s->items[s->count].status = (uint8_t)status;
+    if (slot) *slot = (uint64_t)hash << 32 | (s->count + 1);
+    *added = 1;
+    return (long)s->count++;
+}
+
+/* Keep the higher status of two copies of an item */
+static void item_merge_status(Item *it, TodoStatus status) {
+    if (status_rank[status] > status_rank[it->status]) it->status = (uint8_t)status;
+}
+
+typedef struct {
+    const Program *prog;
+    int uniq;
+    int copy;           /* lines are transient and must be copied */
+    ItemSet set;
+    int *ids;           /* --uniq with an id filter: the id of each item's first copy */
+    size_t ids_cap;
+} Collect;
+
+/* Without --uniq, keep what matches. With it, keep every item and filter
+ * later in collect_filter, once the status is that of all copies. */
+static int collect_one(Todo *todo, Sink *out, void *ctx) {
+    Collect *c = ctx;
+    int added;
+    (void)out;
+
+    if (!c->uniq && !expr_match(c->prog, todo)) return 0;
+    long i = itemset_add(&c->set, todo->text, todo->text_len, todo->status, c->copy, c->uniq, &added);
+    if (i < 0) return -1;
+    if (!added) {
+        item_merge_status(&c->set.items[i], todo->status);
+        return 0;
+    }
+
+    if (c->uniq && c->prog->uses_ids) {
+        if ((size_t)i == c->ids_cap) {
+            size_t cap = c->ids_cap ? c->ids_cap * 2 : 1024;
+            int *ids = realloc(c->ids, sizeof(int) * cap);
+            if (!ids) return -1;
+            c->ids = ids;
+            c->ids_cap = cap;
+        }
+        c->ids[i] = todo->id;
+    }
+    return 0;
+}
+
+/* Drop the merged --uniq items that do not match. The set's table is not
+ * needed past this point and goes stale. */
+static void collect_filter(Collect *c) {
+    size_t kept = 0;
+
+    for (size_t i = 0; i < c->set.count; i++) {
+        const Item *it = &c->set.items[i];
+        Todo todo;
+        memset(&todo, 0, sizeof(todo));
+        todo.id = c->ids ? c->ids[i] : 0;
+        todo.status = (TodoStatus)it->status;
+        todo.text = (char *)it->text;
+        todo.text_len = it->len;
+        if (expr_match(c->prog, &todo)) c->set.items[kept++] = *it;
+    }
+    c->set.count = kept;
+}
+
+/* Sort key for --sort=text: the first 8 bytes, big-endian so integer order
+ * is byte order, decide most comparisons without touching the text */
+typedef struct {
+    uint64_t prefix;
+    const char *text;
+    uint32_t len;
+    uint32_t item;
+} TextKey;
+
+static int text_key_cmp(const void *a, const void *b) {
+    const TextKey *x = a;
+    const TextKey *y = b;
+
+    if (x->prefix != y->prefix) return x->prefix < y->prefix ? -1 : 1;
+
+    size_t n = x->len < y->len ? x->len : y->len;
+    int c = n > 8 ? memcmp(x->text + 8, y->text + 8, n - 8) : 0;
+    if (c == 0 && x->len != y->len) c = x->len < y->len ? -1 : 1;
+    /* Equal texts keep input order */
+    if (c == 0) c = x->item < y->item ? -1 : 1;
+    return c;
+}
+
+/* Item indexes in output order, or NULL on allocation failure */
+static uint32_t *collect_order(const ItemSet *c, SortKey sort) {
+    uint32_t *order = malloc(sizeof(uint32_t) * (c->count ? c->count : 1));
+    if (!order) return NULL;
+
+    if (sort == SORT_STATUS) {
+        /* Counting sort: stable and one pass per status */
+        size_t at = 0;
+        for (int r = 0; r < 3; r++) {
+            for (size_t i = 0; i < c->count; i++) {
+                if (status_rank[c->items[i].status] == r) order[at++] = (uint32_t)i;
+            }
+        }
+    } else if (sort == SORT_TEXT) {
+        TextKey *keys = malloc(sizeof(TextKey) * (c->count ? c->count : 1));
+        if (!keys) {
+            free(order);
+            return NULL;
+        }
+        for (size_t i = 0; i < c->count; i++) {
+            const Item *it = &c->items[i];
+            uint64_t prefix = 0;
+            for (size_t k = 0; k < 8; k++) {
+                prefix = prefix << 8 | (k < it->len ? (unsigned char)it->text[k] : 0);
+            }
+            keys[i].prefix = prefix;
+            keys[i].text = it->text;
+            keys[i].len = it->len;
+            keys[i].item = (uint32_t)i;
+        }
+        qsort(keys, c->count, sizeof(TextKey), text_key_cmp);
+        for (size_t i = 0; i < c->count; i++) order[i] = keys[i].item;
+        free(keys);
+    } else {
+        for (size_t i = 0; i < c->count; i++) order[i] = (uint32_t)i;
+    }
+    return order;
+}
+
+/* Group keys: every label and due date met, interned as "#tag", "@owner"
+ * or "YYYY-MM-DD"; those of the kind grouped by are keys */
+typedef struct {
+    GroupKey by;
+    Dict names;
+    LabelBuf labels;    /* of the last item scanned */
+    TodoMeta meta;
+    const uint32_t *keys;   /* its distinct keys */
+    size_t nkeys;
+    uint32_t due;
+} Groups;
+
+static void groups_init(Groups *g, GroupKey by) {
+    memset(g, 0, sizeof(*g));
+    g->by = by;
+    dict_init(&g->names);
+    g->labels.heap = 1;
+}
+
+static void groups_free(Groups *g) {
+    dict_free(&g->names);
+    labelbuf_free(&g->labels);
+}
+
+/* Tokenize one item's text and pick out its keys */
+static int groups_scan(Groups *g, const char *text, size_t len) {
+    g->labels.count = 0;
+    g->nkeys = 0;
+    if (todo_meta_intern(&g->names, text, len, &g->labels, &g->meta) < 0) return -1;
+
+    if (g->by == GROUP_DUE) {
+        g->due = (uint32_t)g->meta.due_id;
+        g->keys = &g->due;
+        g->nkeys = g->meta.due_id >= 0;
+        return 0;
+    }
+
+    char sigil = g->by == GROUP_TAG ? '#' : '@';
+    uint32_t *ids = g->labels.ids;
+    for (size_t i = 0; i < g->labels.count; i++) {
+        if (*dict_name(&g->names, (int)ids[i], NULL) == sigil) ids[g->nkeys++] = ids[i];
+    }
+    g->keys = ids;
+    return 0;
+}
+
+typedef struct {
+    const char *name;
+    uint32_t slot;
+} GroupName;
+
+static int group_name_cmp(const void *a, const void *b) {
+    return strcmp(((const GroupName *)a)->name, ((const GroupName *)b)->name);
+}
+
+/* Groups in output order as slots, key id + 1, with slot 0 for the items
+ * without a key last. Byte order is date order for YYYY-MM-DD. */
+static uint32_t *groups_order(const Groups *g) {
+    size_t n = g->names.count;
+    uint32_t *order = malloc(sizeof(uint32_t) * (n + 1));
+    GroupName *names = malloc(sizeof(GroupName) * (n ? n : 1));
+
+    if (!order || !names) {
+        free(order);
+        free(names);
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        names[i].name = dict_name(&g->names, (int)i, NULL);
+        names[i].slot = (uint32_t)i + 1;
+    }
+    qsort(names, n, sizeof(GroupName), group_name_cmp);
+    for (size_t i = 0; i < n; i++) order[i] = names[i].slot;
+    order[n] = 0;
+    free(names);
+    return order;
+}
+
+static const char *group_title(const Groups *g, uint32_t slot) {
+    return slot ? dict_name(&g->names, (int)slot - 1, NULL) : "(none)";
+}
+
+static int print_item(const Item *it, Sink *out) {
+    Todo todo;
+    memset(&todo, 0, sizeof(todo));
+    todo.text = (char *)it->text;
+    todo.text_len = it->len;
+    todo.status = (TodoStatus)it->status;
+    return sink_todo(out, &todo) < 0 || out->err ? -1 : 0;
+}
+
+/* One item under one group */
+typedef struct {
+    uint32_t slot;
+    uint32_t item;
+} GroupRef;
+
+/* Print the items of seq under a "## KEY" heading per group. One pass
+ * interns every item's keys, then a counting sort over the group slots
+ * places the (group, item) pairs, keeping seq's order within a group.
+ * The window counts printed items. */
+static int print_groups(const ItemSet *set, const uint32_t *seq, const Order *order, Sink *out) {
+    Groups g;
+    GroupRef *refs = NULL;
+    size_t nrefs = 0;
+    size_t cap = 0;
+    int rc = 0;
+
+    groups_init(&g, order->group);
+    for (size_t i = 0; rc == 0 && i < set->count; i++) {
+        const Item *it = &set->items[seq[i]];
+        if (groups_scan(&g, it->text, it->len) < 0) {
+            rc = -1;
+            break;
+        }
+
+        size_t n = g.nkeys ? g.nkeys : 1;
+        if (nrefs + n > cap) {
+            while (nrefs + n > cap) cap = cap ? cap * 2 : 1024;
+            GroupRef *grown = realloc(refs, sizeof(GroupRef) * cap);
+            if (!grown) {
+                rc = -1;
+                break;
+            }
+            refs = grown;
+        }
+        for (size_t k = 0; k < n; k++) {
+            refs[nrefs].slot = g.nkeys ? (uint32_t)g.keys[k] + 1 : 0;
+            refs[nrefs++].item = seq[i];
+        }
+    }
+
+    size_t nslots = g.names.count + 1;
+    uint32_t *groups = rc == 0 ? groups_order(&g) : NULL;
+    size_t *start = calloc(nslots + 1, sizeof(size_t));
+    size_t *rank = malloc(sizeof(size_t) * nslots);
+    uint32_t *placed = malloc(sizeof(uint32_t) * (nrefs ? nrefs : 1));
+    if (!groups || !start || !rank || !placed) rc = -1;
+
+    if (rc == 0) {
+        for (size_t r = 0; r < nslots; r++) rank[groups[r]] = r;
+        for (size_t i = 0; i < nrefs; i++) start[rank[refs[i].slot] + 1]++;
+        for (size_t r = 0; r < nslots; r++) start[r + 1] += start[r];
+        for (size_t i = 0; i < nrefs; i++) placed[start[rank[refs[i].slot]]++] = refs[i].item;
+        /* Each start[r] has moved on to where group r + 1 begins */
+        memmove(start + 1, start, sizeof(size_t) * nslots);
+        start[0] = 0;
+    }
+
+    size_t skip = order->offset;
+    size_t left = order->limit;
+    int headed = 0;
+    for (size_t r = 0; rc == 0 && r < nslots && left > 0; r++) {
+        int first = 1;
+        for (size_t i = start[r]; rc == 0 && i < start[r + 1] && left > 0; i++) {
+            if (skip > 0) {
+                skip--;
+                continue;
+            }
+            if (first) {
+                const char *title = group_title(&g, groups[r]);
+                if (headed) sink_write(out, "\n", 1);
+                sink_write(out, "## ", 3);
+                sink_write(out, title, strlen(title));
+                sink_write(out, "\n", 1);
+                first = 0;
+                headed = 1;
+            }
+            rc = print_item(&set->items[placed[i]], out);
+            left--;
+        }
+    }
+
+    free(placed);
+    free(rank);
+    free(start);
+    free(groups);
+    free(refs);
+    groups_free(&g);
+    return rc;
+}
+
+/* Collect the input, dedupe and filter it, then sort and/or group what
+ * matched. Unlike plain filtering this holds every matching text (every
+ * distinct text with --uniq), copied only when the input is not mapped. */
+static int cmd_ordered(Input *in, Sink *out, const Program *prog, const Order *order) {
+    Collect c;
+    c.prog = prog;
+    c.uniq = order->uniq;
+    c.copy = !in->map;
+    c.ids = NULL;
+    c.ids_cap = 0;
+    itemset_init(&c.set);
+
+    int rc = stream_todos(in, out, collect_one, &c);
+    if (rc == 0 && c.uniq) collect_filter(&c);
+    uint32_t *seq = rc == 0 ? collect_order(&c.set, order->sort) : NULL;
+    if (!seq) rc = -1;
+
+    if (rc == 0 && order->group) {
+        rc = print_groups(&c.set, seq, order, out);
+    } else {
+        size_t start = order->offset < c.set.count ? order->offset : c.set.count;
+        size_t end = c.set.count - start > order->limit ? start + order->limit : c.set.count;
+        for (size_t i = start; rc == 0 && i < end; i++) rc = print_item(&c.set.items[seq[i]], out);
+    }
+
+    free(seq);
+    free(c.ids);
+    itemset_free(&c.set);
+    return rc;
+}
+
+typedef struct {
+    const Program *prog;
+    size_t skip;
+    size_t left;
+} Window;
+
+/* Print matches offset + 1 to offset + limit, then stop reading */
+static int filter_window(Todo *todo, Sink *out, void *ctx) {
+    Window *w = ctx;
+
+    if (w->left == 0) return STREAM_DONE;
+    if (!expr_match(w->prog, todo)) return 0;
+    if (w->skip > 0) {
+        w->skip--;
+        return 0;
+    }
+    emit_todo(todo, out);
+    if (out->err) return -1;
+    return --w->left == 0 ? STREAM_DONE : 0;
+}
+
+/* Format/filter input to output, in input order unless order says
+ * otherwise (order may be NULL) */
+static int cmd_filter(Input *in, Sink *out, int jobs, const Program *prog, const Order *order) {
+    if (order && (order->uniq || order->sort != SORT_NONE || order->group)) {
+        return cmd_ordered(in, out, prog, order);
+    }
+
+    /* A window is read serially: the point is to stop early */
+    if (order && (order->offset > 0 || order->limit != SIZE_MAX)) {
+        Window w = { prog, order->offset, order->limit };
+        int rc = in->follow ? stream_follow(in, out, filter_window, &w) : stream_todos(in, out, filter_window, &w);
+        return rc == STREAM_DONE ? 0 : rc;
+    }
+    todo_fn fn = expr_is_trivial(prog) ? format_one : filter_one;
+    return stream_parallel(in, out, fn, (void *)prog, prog->uses_ids, jobs);
+}
+
+typedef struct {
+    TodoStatus new_status;
+    const Program *prog;
+} MarkCtx;
+
+static int mark_one(Todo *todo, Sink *out, void *ctx) {
+    MarkCtx *m = ctx;
+    if (expr_match(m->prog, todo)) {
+        todo->status = m->new_status;
+    }
+    emit_todo(todo, out);
+    return out->err ? -1 : 0;
+}
+
+/* Modify status in stream - every item the program selects */
+static int cmd_status_stream(Input *in, Sink *out, int jobs, TodoStatus new_status, const Program *prog) {
+    MarkCtx m = { new_status, prog };
+    return stream_parallel(in, out, mark_one, &m, prog->uses_ids, jobs);
+}
+
+/* Start fzf with a pipe on each end. Lines fed to it are "ID\tTODO" with
+ * only the todo shown, so every selection comes back carrying its id. */
+static pid_t fzf_spawn(int *to, int *from) {
+    int in[2], out[2];
+
+    if (pipe(in) < 0) return -1;
+    if (pipe(out) < 0) {
+        close(in[0]);
+        close(in[1]);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execlp("fzf", "fzf", "--delimiter=\t", "--with-nth=2..", (char *)NULL);
+        _exit(127);
+    }
+
+    close(in[0]);
+    close(out[1]);
+    if (pid < 0) {
+        close(in[1]);
+        close(out[0]);
+        return -1;
+    }
+    *to = in[1];
+    *from = out[0];
+    return pid;
+}
+
+static int fzf_feed(Todo *todo, Sink *out, void *ctx) {
+    const Program *prog = ctx;
+    char head[16];
+
+    if (!expr_match(prog, todo)) return 0;
+    sink_write(out, head, (size_t)snprintf(head, sizeof(head), "%d\t", todo->id));
+    emit_todo(todo, out);
+    return 0;
+}
+
+/* Modify status with fzf selection among the items prog matches. Items
+ * stream into fzf while the input is still being read. */
+static int cmd_status_fzf(Input *in, Sink *out, TodoStatus new_status, const Program *prog) {
+    int to, from;
+    pid_t pid = fzf_spawn(&to, &from);
+    if (pid < 0) {
+        fprintf(stderr, "Failed to run fzf\n");
+        return 1;
+    }
+
+    /* fzf may quit before reading everything; that is EPIPE, not a signal */
+    struct sigaction ignore, saved;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &saved);
+
+    Sink *to_fzf = malloc(sizeof(Sink));
+    TodoList *list = NULL;
+    if (to_fzf) {
+        sink_init_fd(to_fzf, to);
+        list = read_todos(in, to_fzf, fzf_feed, (void *)prog);
+        sink_flush(to_fzf);
+        free(to_fzf);
+    }
+    close(to);
+
+    /* The selection is small: one "ID\t..." line per chosen item */
+    char *sel = NULL;
+    size_t sel_len = 0;
+    size_t sel_cap = 0;
+    for (;;) {
+        if (sel_len == sel_cap) {
+            sel_cap = sel_cap ? sel_cap * 2 : 4096;
+            char *grown = realloc(sel, sel_cap + 1);
+            if (!grown) break;
+            sel = grown;
+        }
+        ssize_t n = read(from, sel + sel_len, sel_cap - sel_len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        sel_len += (size_t)n;
+    }
+    close(from);
+    if (sel) sel[sel_len] = '\0';
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    sigaction(SIGPIPE, &saved, NULL);
+
+    int rc = 0;
+    if (!list) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        rc = 1;
+    } else if (WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "Failed to run fzf\n");
+        rc = 1;
+    } else {
+        for (size_t i = 0; i < sel_len; ) {
+            char *end;
+            long id = strtol(sel + i, &end, 10);
+            if (*end == '\t') todolist_set_status(list, (int)id, new_status);
+
+            const char *nl = memchr(sel + i, '\n', sel_len - i);
+            i = nl ? (size_t)(nl - sel) + 1 : sel_len;
+        }
+        output_todos(list, out);
+    }
+
+    free(sel);
+    if (list) todolist_free(list);
+    return rc;
+}
+
+/* Files given on the command line are shared out to a pool of threads.
+ * Each worker claims the next unstarted file when it finishes one, so a
+ * few huge files and many tiny ones still keep every thread busy. With a
+ * drain function, the calling thread consumes finished files in order
+ * instead of working, and workers stay at most window files ahead of it. */
+typedef struct FilePool FilePool;
+
+struct FilePool {
+    size_t n;
+    size_t next;        /* next file to hand out */
+    size_t drained;     /* files the drain function has finished with */
+    size_t window;
+    char *done;
+    int (*run)(size_t i, void *ctx);
+    void *ctx;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void *file_worker(void *arg) {
+    FilePool *pool = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->next < pool->n && pool->next >= pool->drained + pool->window) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        size_t i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (i >= pool->n) {
+            prof_flush();
+            return NULL;
+        }
+        pool->run(i, pool->ctx);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->done[i] = 1;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* For drain functions: wait until file i is finished */
+static void files_wait(FilePool *pool, size_t i) {
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->done[i]) pthread_cond_wait(&pool->cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* For drain functions: file i has been consumed */
+static void files_release(FilePool *pool, size_t i) {
+    pthread_mutex_lock(&pool->lock);
+    pool->drained = i + 1;
+    pthread_cond_broadcast(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static int files_run(size_t n, int jobs, int (*run)(size_t, void *),
+                     void (*drain)(FilePool *, void *), void *ctx) {
+    FilePool pool = { n, 0, 0, (size_t)-1, NULL, run, ctx,
+                      PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+    pthread_t *threads = NULL;
+    int started = 0;
+
+    pool.done = calloc(n ? n : 1, 1);
+    if (!pool.done) return -1;
+    if (drain) pool.window = (size_t)jobs * 2;
+
+    if ((size_t)jobs > n) jobs = (int)n;
+    if (jobs > 1 || (drain && jobs > 0)) threads = malloc(sizeof(pthread_t) * (size_t)jobs);
+    for (; threads && started < jobs; started++) {
+        if (pthread_create(&threads[started], NULL, file_worker, &pool) != 0) break;
+    }
+
+    if (drain && started == 0) {
+        /* No threads to be had: do all the work first */
+        pool.window = (size_t)-1;
+        file_worker(&pool);
+    }
+    if (drain) {
+        drain(&pool, ctx);
+    } else {
+        /* The calling thread works too */
+        file_worker(&pool);
+    }
+
+    for (int i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    free(threads);
+    free(pool.done);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.cond);
+    return 0;
+}
+
+/* Counting mode: tally matching todos per status without writing them */
+typedef struct {
+    size_t by_status[3];
+    int err;            /* errno from opening the file, 0 if fine */
+} Counts;
+
+typedef struct {
+    const Program *prog;
+    const char **paths;
+    Counts *counts;
+} CountJob;
+
+/* Unless the filter reads text, lines are only classified by their
+ * marker: no text is extracted and nothing is copied. A filter that
+ * takes every item is not run at all. */
+static void tally(Input *in, const Program *prog, Counts *counts) {
+    int need_text = expr_needs_text(prog);
+    int all = expr_is_trivial(prog);
+    const char *line;
+    size_t len;
+    int id = 1;
+
+    while (input_next(in, &line, &len)) {
+        Todo todo;
+        if (need_text) {
+            todo_parse(line, len, &todo, id);
+            if (!todo.text) continue;
+        } else {
+            if (!todo_classify(line, len, &todo.status)) continue;
+            todo.id = id;
+        }
+        id++;
+        if (all || expr_match(prog, &todo)) counts->by_status[todo.status]++;
+    }
+}
+
+static int count_file(size_t i, void *ctx) {
+    CountJob *all = ctx;
+    Counts *counts = &all->counts[i];
+    FILE *fp = all->paths ? fopen(all->paths[i], "r") : stdin;
+    Input in;
+
+    if (!fp) {
+        counts->err = errno;
+        return -1;
+    }
+    if (input_open(&in, fp) < 0) {
+        counts->err = ENOMEM;
+    } else {
+        tally(&in, all->prog, counts);
+        input_close(&in);
+    }
+    if (fp != stdin) fclose(fp);
+    return counts->err ? -1 : 0;
+}
+
+static void sink_count(Sink *out, const char *fmt, const char *name, size_t n) {
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), fmt, name, n);
+    if (len > 0) sink_write(out, buf, (size_t)len);
+}
+
+/* The total alone, or per status as text or JSON */
+static void print_counts(const Counts *total, int stats, int json, Sink *out) {
+    static const TodoStatus order[] = { STATUS_TODO, STATUS_IN_PROGRESS, STATUS_DONE };
+    size_t sum = total->by_status[0] + total->by_status[1] + total->by_status[2];
+
+    if (!stats) {
+        sink_count(out, "%s%zu\n", "", sum);
+    } else if (json) {
+        for (int i = 0; i < 3; i++) {
+            sink_count(out, i == 0 ? "{\"%s\":%zu" : ",\"%s\":%zu",
+                       status_to_str(order[i]), total->by_status[order[i]]);
+        }
+        sink_count(out, ",\"%s\":%zu}\n", "total", sum);
+    } else {
+        for (int i = 0; i < 3; i++) {
+            sink_count(out, "%s\t%zu\n", status_to_str(order[i]), total->by_status[order[i]]);
+        }
+        sink_count(out, "%s\t%zu\n", "total", sum);
+    }
+}
+
+/* --count prints how many todos match; --stats breaks them down by status,
+ * as text or JSON. Several files are counted concurrently and summed. */
+static int cmd_count(const char **paths, size_t n, int jobs, const Program *prog,
+                     int stats, int json, Sink *out) {
+    Counts *counts = calloc(n ? n : 1, sizeof(Counts));
+    if (!counts) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 1;
+    }
+
+    CountJob job = { prog, n ? paths : NULL, counts };
+    if (files_run(n ? n : 1, jobs, count_file, NULL, &job) < 0) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        free(counts);
+        return 1;
+    }
+
+    Counts total;
+    int rc = 0;
+    memset(&total, 0, sizeof(total));
+    for (size_t i = 0; i < (n ? n : 1); i++) {
+        if (counts[i].err) {
+            fprintf(stderr, "Cannot open file: %s: %s\n", n ? paths[i] : "-", strerror(counts[i].err));
+            rc = 1;
+        }
+        for (int s = 0; s < 3; s++) total.by_status[s] += counts[i].by_status[s];
+    }
+    free(counts);
+
+    print_counts(&total, stats, json, out);
+    return rc;
+}
+
+/* Matching items per group key, one file after another into the same
+ * table; counts[slot] is for key id slot - 1, counts[0] for no key */
+typedef struct {
+    const Program *prog;
+    Groups groups;
+    size_t *counts;
+    size_t cap;
+} GroupCount;
+
+static int group_tally(Input *in, GroupCount *gc) {
+    const char *line;
+    size_t len;
+    int id = 1;
+
+    while (input_next(in, &line, &len)) {
+        Todo todo;
+        todo_parse(line, len, &todo, id);
+        if (!todo.text) continue;
+        id++;
+        if (!expr_match(gc->prog, &todo)) continue;
+        if (groups_scan(&gc->groups, todo.text, todo.text_len) < 0) return -1;
+
+        size_t need = gc->groups.names.count + 1;
+        if (need > gc->cap) {
+            size_t cap = gc->cap ? gc->cap * 2 : 64;
+            while (cap < need) cap *= 2;
+            size_t *counts = realloc(gc->counts, sizeof(size_t) * cap);
+            if (!counts) return -1;
+            memset(counts + gc->cap, 0, sizeof(size_t) * (cap - gc->cap));
+            gc->counts = counts;
+            gc->cap = cap;
+        }
+        if (gc->groups.nkeys == 0) gc->counts[0]++;
+        for (size_t k = 0; k < gc->groups.nkeys; k++) gc->counts[gc->groups.keys[k] + 1]++;
+    }
+    return 0;
+}
+
+/* --count with --group-by: "KEY<TAB>N" per group in key order, items
+ * without a key last as "(none)" */
+static int cmd_group_count(const char **paths, size_t n, const Program *prog, GroupKey by, Sink *out) {
+    GroupCount gc;
+    int rc = 0;
+
+    memset(&gc, 0, sizeof(gc));
+    gc.prog = prog;
+    groups_init(&gc.groups, by);
+
+    for (size_t i = 0; i < (n ? n : 1); i++) {
+        FILE *fp = n ? fopen(paths[i], "r") : stdin;
+        Input in;
+        if (!fp) {
+            fprintf(stderr, "Cannot open file: %s: %s\n", paths[i], strerror(errno));
+            rc = 1;
+            continue;
+        }
+        if (input_open(&in, fp) < 0) {
+            fprintf(stderr, "Failed to allocate memory\n");
+            rc = 1;
+        } else {
+            if (group_tally(&in, &gc) < 0) {
+                fprintf(stderr, "Failed to allocate memory\n");
+                rc = 1;
+            }
+            input_close(&in);
+        }
+        if (fp != stdin) fclose(fp);
+    }
+
+    uint32_t *order = groups_order(&gc.groups);
+    if (!order) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        rc = 1;
+    }
+    for (size_t r = 0; order && r <= gc.groups.names.count; r++) {
+        size_t count = order[r] < gc.cap ? gc.counts[order[r]] : 0;
+        if (count > 0) {
+            const char *title = group_title(&gc.groups, order[r]);
+            sink_write(out, title, strlen(title));
+            sink_count(out, "%s\t%zu\n", "", count);
+        }
+    }
+
+    free(order);
+    free(gc.counts);
+    groups_free(&gc.groups);
+    return rc;
+}
+
+/* Rewriting a file for -w. Output goes to a temp file in the same directory
+ * that is synced and renamed over the original, so a crash at any point
+ * leaves either the old or the new contents, never a mix. */
+typedef struct {
+    char *path;         /* resolved target, so symlinks are written through */
+    char *tmp;
+    int fd;
+} Replace;
+
+static int replace_open(Replace *r, const char *file_path) {
+    struct stat st;
+
+    r->tmp = NULL;
+    r->fd = -1;
+    r->path = realpath(file_path, NULL);
+    if (!r->path || stat(r->path, &st) < 0) return -1;
+
+    const char *slash = strrchr(r->path, '/');
+    size_t dir_len = (size_t)(slash - r->path) + 1;
+    r->tmp = malloc(dir_len + strlen(slash + 1) + sizeof(".chop-XXXXXX") + 1);
+    if (!r->tmp) return -1;
+    sprintf(r->tmp, "%.*s.%s.chop-XXXXXX", (int)dir_len, r->path, slash + 1);
+
+    r->fd = mkstemp(r->tmp);
+    if (r->fd < 0) return -1;
+
+    /* Keep the original's permissions; without them the rename would
+     * quietly change who can read the file. replace_close removes the
+     * temp file. */
+    if (fchmod(r->fd, st.st_mode & 07777) < 0) return -1;
+    /* Best effort: only root may give the file to another owner */
+    (void)fchown(r->fd, st.st_uid, st.st_gid);
+    return 0;
+}
+
+static int replace_commit(Replace *r) {
+    if (fsync(r->fd) < 0 || close(r->fd) < 0) {
+        r->fd = -1;
+        return -1;
+    }
+    r->fd = -1;
+
+    if (rename(r->tmp, r->path) < 0) return -1;
+    free(r->tmp);
+    r->tmp = NULL;
+
+    /* Make the rename itself durable */
+    char *slash = strrchr(r->path, '/');
+    *slash = '\0';
+    int dir = open(*r->path ? r->path : "/", O_RDONLY);
+    *slash = '/';
+    if (dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+    return 0;
+}
+
+static void replace_close(Replace *r) {
+    if (r->fd >= 0) close(r->fd);
+    if (r->tmp) unlink(r->tmp);
+    free(r->tmp);
+    free(r->path);
+}
+
+/* A pure mark on a file whose every line is already canonical only changes
+ * status bytes, so patch those through a shared mapping instead of
+ * rewriting the file. Returns 0 when done, 1 when the file needs the full
+ * rewrite, -1 on error. */
+static int mark_in_place(const char *path, TodoStatus new_status, const Program *prog) {
+    struct stat st;
+    int fd = open(path, O_RDWR);
+    if (fd < 0) return 1;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return 1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return 1;
+    }
+
+    Input in;
+    const char *line;
+    size_t len;
+    int id;
+    int rc = 0;
+
+    /* Pass 1 only reads: bail out before touching anything if some line
+     * would be reformatted or dropped */
+    memset(&in, 0, sizeof(in));
+    in.map = map;
+    in.map_len = size;
+    for (id = 1; input_next(&in, &line, &len); id++) {
+        Todo todo;
+        todo_parse(line, len, &todo, id);
+        if (!todo.text || !is_canonical(&todo)) {
+            rc = 1;
+            break;
+        }
+    }
+
+    /* A store past the end of a file someone cut short since it was
+     * mapped raises SIGBUS; take the rewrite path instead */
+    if (rc == 0 && (fstat(fd, &st) < 0 || (size_t)st.st_size != size)) rc = 1;
+
+    if (rc == 0) {
+        char c = status_to_char(new_status);
+
+        memset(&in, 0, sizeof(in));
+        in.map = map;
+        in.map_len = size;
+        for (id = 1; input_next(&in, &line, &len); id++) {
+            Todo todo;
+            todo_parse(line, len, &todo, id);
+            if (todo.raw_line[3] != c && expr_match(prog, &todo)) {
+                map[todo.raw_line + 3 - map] = c;
+            }
+        }
+        if (msync(map, size, MS_SYNC) < 0) rc = -1;
+        /* Stores through a mapping raise no inotify event; touching the
+         * file tells watchers such as --serve */
+        futimens(fd, NULL);
+    }
+
+    munmap(map, size);
+    close(fd);
+    return rc;
+}
+
+/* Bring the sidecar index of a mapped file up to date and attach it to the
+ * input. A file that only grew since the last run is parsed from where the
+ * index stops; one that was edited in any other way is indexed afresh.
+ * Failing to save the index is not an error, it is only a cache. */
+static void index_sync(TodoIndex *idx, const char *file_path, Input *in) {
+    struct stat st;
+    char *path = index_path(file_path);
+
+    if (!path || in->pos != 0 || fstat(fileno(in->fp), &st) < 0) {
+        free(path);
+        return;
+    }
+
+    int fresh = index_load(idx, path) == 0 && idx->dev == (uint64_t)st.st_dev &&
+                idx->ino == (uint64_t)st.st_ino && idx->covered <= in->map_len;
+    int changed = !fresh || idx->size != (uint64_t)st.st_size ||
+                  idx->mtime_sec != (int64_t)st.st_mtim.tv_sec ||
+                  idx->mtime_nsec != (int64_t)st.st_mtim.tv_nsec;
+
+    /* Same size and mtime: trust it. Otherwise the indexed bytes must be
+     * unchanged for the index to be extended rather than rebuilt. */
+    if (fresh && changed && index_hash(in->map, (size_t)idx->covered) != idx->hash) {
+        fresh = 0;
+    }
+    if (!fresh) index_clear(idx);
+
+    if (changed) {
+        size_t end = (size_t)idx->covered;
+        const char *line;
+        size_t len;
+        int id = (int)idx->count + 1;
+
+        /* Index complete lines only; a partial last line may still grow */
+        in->pos = end;
+        while (input_next(in, &line, &len) && line[len - 1] == '\n') {
+            Todo todo;
+            todo_parse(line, len, &todo, id);
+            end = (size_t)(line - in->map) + len;
+            if (!todo.text) continue;
+
+            IndexEntry e;
+            e.offset = (uint64_t)(line - in->map);
+            e.raw_len = (uint32_t)len;
+            e.text_off = (uint32_t)(todo.text - line);
+            e.text_len = (uint32_t)todo.text_len;
+            e.status = (uint32_t)todo.status;
+            if (len > UINT32_MAX || index_push(idx, &e) < 0) {
+                end = (size_t)e.offset;
+                break;
+            }
+            id++;
+        }
+
+        idx->hash = index_hash(in->map, end);
+        idx->covered = end;
+        idx->size = (uint64_t)st.st_size;
+        idx->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+        idx->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+        idx->dev = (uint64_t)st.st_dev;
+        idx->ino = (uint64_t)st.st_ino;
+        index_save(idx, path);
+
+        in->nl_next = in->nl_count = 0;
+        in->pos = 0;
+    }
+
+    in->index = idx;
+    free(path);
+}
+
+/* Batch mode: many files, or directory trees, each filtered or marked on
+ * its own. Output is buffered per file and written in argument order with
+ * a "path:" prefix on every line; with -w each file is rewritten instead. */
+typedef struct {
+    char **paths;
+    size_t n;
+    size_t cap;
+} PathList;
+
+static int paths_add(PathList *list, const char *path) {
+    if (list->n == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 64;
+        char **paths = realloc(list->paths, sizeof(char *) * cap);
+        if (!paths) return -1;
+        list->paths = paths;
+        list->cap = cap;
+    }
+    char *copy = strdup(path);
+    if (!copy) return -1;
+    list->paths[list->n++] = copy;
+    return 0;
+}
+
+static void paths_free(PathList *list) {
+    for (size_t i = 0; i < list->n; i++) free(list->paths[i]);
+    free(list->paths);
+}
+
+static int name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Add path, or every regular file under it whose name matches glob, in
+ * sorted order so the output never depends on the directory layout on
+ * disk. Hidden entries are skipped; so are chop's own sidecar files. */
+static int paths_collect(PathList *list, const char *path, const char *glob, int top) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        fprintf(stderr, "Cannot open file: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        const char *base = strrchr(path, '/');
+        base = base ? base + 1 : path;
+        if (!top && (!S_ISREG(st.st_mode) || (glob && fnmatch(glob, base, 0) != 0))) return 0;
+        return paths_add(list, path);
+    }
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        fprintf(stderr, "Cannot open directory: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    PathList names = { NULL, 0, 0 };
+    struct dirent *ent;
+    int rc = 0;
+    while (rc == 0 && (ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] == '.') continue;
+        rc = paths_add(&names, ent->d_name);
+    }
+    closedir(dir);
+    qsort(names.paths, names.n, sizeof(char *), name_cmp);
+
+    size_t dir_len = strlen(path);
+    while (dir_len > 1 && path[dir_len - 1] == '/') dir_len--;
+    for (size_t i = 0; rc == 0 && i < names.n; i++) {
+        char *child = malloc(dir_len + strlen(names.paths[i]) + 2);
+        if (!child) {
+            rc = -1;
+            break;
+        }
+        sprintf(child, "%.*s/%s", (int)dir_len, path, names.paths[i]);
+        rc = paths_collect(list, child, glob, 0);
+        free(child);
+    }
+    paths_free(&names);
+    return rc;
+}
+
+typedef struct {
+    const char *path;
+    char *out;          /* buffered output, from open_memstream */
+    size_t out_len;
+    int err;            /* errno of the failure, 0 if none */
+    const char *failed; /* what failed */
+} BatchFile;
+
+typedef struct {
+    BatchFile *files;
+    const Program *prog;
+    const Order *order;
+    int do_mark;
+    TodoStatus mark_status;
+    int do_write;
+    Sink *out;
+    int rc;
+} Batch;
+
+static int batch_one(const Batch *b, Input *in, Sink *out) {
+    if (b->do_mark) return cmd_status_stream(in, out, 1, b->mark_status, b->prog);
+    return cmd_filter(in, out, 1, b->prog, b->order);
+}
+
+static int batch_file(size_t i, void *ctx) {
+    Batch *b = ctx;
+    BatchFile *f = &b->files[i];
+    Replace replace;
+    FILE *mem = NULL;
+    Input in;
+
+    if (b->do_write && b->do_mark) {
+        int rc = mark_in_place(f->path, b->mark_status, b->prog);
+        if (rc < 0) {
+            f->err = errno;
+            f->failed = "Cannot write to file";
+        }
+        if (rc <= 0) return rc;
+    }
+
+    FILE *fp = fopen(f->path, "r");
+    if (!fp) {
+        f->err = errno;
+        f->failed = "Cannot open file";
+        return -1;
+    }
+
+    Sink *sink = malloc(sizeof(Sink));
+    if (!sink || input_open(&in, fp) < 0) {
+        free(sink);
+        fclose(fp);
+        f->err = ENOMEM;
+        f->failed = "Cannot read file";
+        return -1;
+    }
+
+    if (b->do_write) {
+        if (replace_open(&replace, f->path) < 0) {
+            f->err = errno;
+            f->failed = "Cannot create temporary file for";
+        } else {
+            sink_init_fd(sink, replace.fd);
+        }
+    } else {
+        mem = open_memstream(&f->out, &f->out_len);
+        if (!mem) {
+            f->err = errno;
+            f->failed = "Cannot buffer output for";
+        } else {
+            sink_init_file(sink, mem);
+        }
+    }
+
+    if (!f->err) {
+        if (batch_one(b, &in, sink) != 0 || sink_flush(sink) < 0) {
+            f->err = sink->err ? sink->err : EIO;
+            f->failed = "Cannot write output for";
+        }
+    }
+    input_close(&in);
+    fclose(fp);
+
+    if (b->do_write) {
+        if (!f->err && replace_commit(&replace) < 0) {
+            f->err = errno;
+            f->failed = "Cannot write to file";
+        }
+        replace_close(&replace);
+    } else if (mem && fclose(mem) != 0 && !f->err) {
+        f->err = errno;
+        f->failed = "Cannot buffer output for";
+    }
+
+    free(sink);
+    return f->err ? -1 : 0;
+}
+
+/* Copy buf to out, each line behind prefix */
+static void write_prefixed(Sink *out, const char *prefix, size_t prefix_len,
+                           const char *buf, size_t len) {
+    while (len > 0) {
+        size_t n = scan_newline(buf, len);
+        if (n < len) n++;
+        sink_write(out, prefix, prefix_len);
+        sink_write(out, buf, n);
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Runs on the main thread: write each file's output as soon as it and
+ * every file before it are done */
+static void batch_drain(FilePool *pool, void *ctx) {
+    Batch *b = ctx;
+
+    for (size_t i = 0; i < pool->n; i++) {
+        BatchFile *f = &b->files[i];
+        files_wait(pool, i);
+
+        if (f->err) {
+            fprintf(stderr, "%s %s: %s\n", f->failed, f->path, strerror(f->err));
+            b->rc = 1;
+        }
+        if (f->out) {
+            size_t path_len = strlen(f->path);
+            char *prefix = malloc(path_len + 2);
+            if (prefix) {
+                sprintf(prefix, "%s:", f->path);
+                write_prefixed(b->out, prefix, path_len + 1, f->out, f->out_len);
+                free(prefix);
+            }
+            free(f->out);
+            f->out = NULL;
+        }
+        files_release(pool, i);
+    }
+}
+
+static int cmd_batch(PathList *paths, int jobs, const Program *prog, const Order *order,
+                     int do_mark, TodoStatus mark_status, int do_write, Sink *out) {
+    Batch b = { NULL, prog, order, do_mark, mark_status, do_write, out, 0 };
+
+    b.files = calloc(paths->n ? paths->n : 1, sizeof(BatchFile));
+    if (!b.files) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 1;
+    }
+    for (size_t i = 0; i < paths->n; i++) b.files[i].path = paths->paths[i];
+
+    if (files_run(paths->n, jobs, batch_file, batch_drain, &b) < 0) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        b.rc = 1;
+    }
+    free(b.files);
+    return b.rc;
+}
+
+/* --diff and --merge key items by their text with whitespace runs
+ * collapsed and trailing blanks dropped, so reflowed spacing is not a
+ * change and a status flip is just a status change. A text that repeats
+ * is a separate item per copy, keyed "text\nN" from the second copy on,
+ * so the Nth copies in two files pair up. Each file becomes an ItemSet,
+ * and every comparison is one hash lookup. */
+typedef struct {
+    FILE *fp;
+    Input in;
+    const Program *prog;
+    ItemSet set;
+    Todo *first;        /* the todo each item was read as */
+    uint32_t *copies;   /* for an item's first copy, how many there are */
+    size_t first_cap;
+    char *scratch;      /* room to normalize the current text and number it */
+    size_t scratch_cap;
+} Side;
+
+/* Normalized key for text: text itself when it is already normal, else
+ * built in scratch, which must hold len bytes */
+static const char *normalize(char *scratch, const char *text, size_t len, size_t *out_len) {
+    size_t i;
+    for (i = 0; i < len; i++) {
+        if (text[i] == '\t' || (text[i] == ' ' && (i + 1 == len || text[i + 1] == ' '))) break;
+    }
+    if (i == len) {
+        *out_len = len;
+        return text;
+    }
+
+    char *key = scratch;
+    size_t n = 0;
+    for (i = 0; i < len; i++) {
+        int blank = text[i] == ' ' || text[i] == '\t';
+        if (blank && (n == 0 || key[n - 1] == ' ')) continue;
+        key[n++] = blank ? ' ' : text[i];
+    }
+    while (n > 0 && key[n - 1] == ' ') n--;
+    *out_len = n;
+    return key;
+}
+
+static int side_keep(Todo *todo, Sink *out, void *ctx) {
+    Side *s = ctx;
+    (void)out;
+
+    if (!expr_match(s->prog, todo)) return 0;
+    /* The text, "\n" and a copy number */
+    if (todo->text_len + 12 > s->scratch_cap) {
+        char *grown = realloc(s->scratch, todo->text_len + 12);
+        if (!grown) return -1;
+        s->scratch = grown;
+        s->scratch_cap = todo->text_len + 12;
+    }
+    if (s->set.count == s->first_cap) {
+        size_t cap = s->first_cap ? s->first_cap * 2 : 1024;
+        Todo *first = realloc(s->first, sizeof(Todo) * cap);
+        if (!first) return -1;
+        s->first = first;
+        uint32_t *copies = realloc(s->copies, sizeof(uint32_t) * cap);
+        if (!copies) return -1;
+        s->copies = copies;
+        s->first_cap = cap;
+    }
+
+    /* Only keys that had to be rewritten get copied */
+    size_t len;
+    int added;
+    const char *key = normalize(s->scratch, todo->text, todo->text_len, &len);
+    long at = itemset_lookup(&s->set, key, len);
+    if (at >= 0) {
+        if (key != s->scratch) memcpy(s->scratch, key, len);
+        key = s->scratch;
+        len += (size_t)sprintf(s->scratch + len, "\n%lu", (unsigned long)++s->copies[at]);
+    }
+    at = itemset_add(&s->set, key, len, todo->status, key == s->scratch, 1, &added);
+    if (at < 0) return -1;
+    s->copies[at] = 1;
+
+    /* Buffered lines do not outlive the callback */
+    Todo *first = &s->first[at];
+    *first = *todo;
+    if (!s->in.map) {
+        first->text = arena_strndup(&s->set.arena, todo->text, todo->text_len);
+        if (!first->text) return -1;
+        first->raw_line = first->text;
+        first->raw_len = todo->text_len;
+    }
+    return 0;
+}
+
+/* Read path and key its todos. Only todos matching prog count. */
+static int side_open(Side *s, const char *path, const Program *prog) {
+    memset(s, 0, sizeof(*s));
+    s->prog = prog;
+    itemset_init(&s->set);
+
+    s->fp = fopen(path, "r");
+    if (!s->fp) return -1;
+    if (input_open(&s->in, s->fp) < 0) {
+        fclose(s->fp);
+        s->fp = NULL;
+        return -1;
     }
-    return -1;
+    return stream_todos(&s->in, NULL, side_keep, s) == 0 ? 0 : -1;
+}
+
+static void side_close(Side *s) {
+    free(s->first);
+    free(s->copies);
+    free(s->scratch);
+    itemset_free(&s->set);
+    if (s->fp) {
+        input_close(&s->in);
+        fclose(s->fp);
+    }
+}
+
+/* Where item i of s is in other, -1 if it is not */
+static long side_find(Side *other, const Side *s, size_t i) {
+    return itemset_lookup(&other->set, s->set.items[i].text, s->set.items[i].len);
+}
+
+/* Write item i of s in canonical form with the given status, after sign */
+static void emit_item(Sink *out, const char *sign, const Side *s, size_t i, TodoStatus status) {
+    Todo todo = s->first[i];
+    todo.status = status;
+    if (sign) sink_write(out, sign, 2);
+    sink_todo(out, &todo);
+}
+
+static int sides_open(Side *sides, const char **paths, int n, const Program *prog) {
+    for (int i = 0; i < n; i++) {
+        if (side_open(&sides[i], paths[i], prog) < 0) {
+            fprintf(stderr, "Cannot read file: %s: %s\n", paths[i], strerror(errno ? errno : ENOMEM));
+            for (int j = 0; j <= i; j++) side_close(&sides[j]);
+            return -1;
+        }
+    }
+    return 0;
 }
 
-/* Helper to parse a line into a todo */
-static void parse_todo_line(char *line, Todo *todo, int id) {
-    todo->raw_line = strdup(line);
-    todo->status = STATUS_TODO;
-    todo->text = NULL;
-    todo->id = 0;
+/* "+ " for items only in B, "- " for items only in A, "~ " for items whose
+ * status changed, shown with B's status. Returns 0 when the files hold the
+ * same items, 1 when they differ, 2 on trouble, like diff(1). */
+static int cmd_diff(const char *a_path, const char *b_path, const Program *prog, Sink *out) {
+    const char *paths[2] = { a_path, b_path };
+    Side sides[2];
+    if (sides_open(sides, paths, 2, prog) < 0) return 2;
+    Side *a = &sides[0], *b = &sides[1];
+    int differ = 0;
 
-    char *p = line;
-    while (*p && (*p == ' ' || *p == '\t')) p++;
+    for (size_t i = 0; i < a->set.count; i++) {
+        if (side_find(b, a, i) >= 0) continue;
+        emit_item(out, "- ", a, i, (TodoStatus)a->set.items[i].status);
+        differ = 1;
+    }
+    for (size_t i = 0; i < b->set.count; i++) {
+        long j = side_find(a, b, i);
+        TodoStatus status = (TodoStatus)b->set.items[i].status;
+        if (j >= 0 && a->set.items[j].status == status) continue;
+        emit_item(out, j < 0 ? "+ " : "~ ", b, i, status);
+        differ = 1;
+    }
+
+    side_close(a);
+    side_close(b);
+    return differ;
+}
+
+/* Status of an item both sides kept. A change on one side wins; if both
+ * changed it differently, the higher status does. */
+static TodoStatus merge_status(int base, TodoStatus ours, TodoStatus theirs, int *conflict) {
+    if (ours == theirs) return ours;
+    if (base == (int)ours) return theirs;
+    if (base == (int)theirs) return ours;
+    *conflict = 1;
+    return status_rank[ours] > status_rank[theirs] ? ours : theirs;
+}
+
+static void merge_conflict(const Side *s, size_t i, const char *what) {
+    const Todo *todo = &s->first[i];
+    fprintf(stderr, "Conflict: %.*s: %s\n", (int)todo->text_len, todo->text, what);
+}
 
-    /* Skip empty lines */
-    size_t len = strlen(p);
-    while (len > 0 && (p[len-1] == '\n' || p[len-1] == '\r' || p[len-1] == ' ')) len--;
-    if (len == 0) return;
+/* Per-item merge decisions. Theirs-only items are chained per anchor: the
+ * ours index they follow, or the ours count for the very start. */
+typedef struct {
+    long *head;
+    long *tail;
+    long *next;
+    uint8_t *keep;
+    uint8_t *status;
+} MergePlan;
 
-    char *text_start = p;
+/* Returns the number of conflicts */
+static size_t merge_sides(Side *base, Side *ours, Side *theirs, MergePlan *m, Sink *out) {
+    size_t n_ours = ours->set.count;
+    size_t n_theirs = theirs->set.count;
+    size_t conflicts = 0;
 
-    /* Check for list marker */
-    if ((*p == '-' || *p == '*' || *p == '+') && p[1] == ' ') {
-        p += 2;
-        while (*p == ' ') p++;
-        text_start = p;
+    for (size_t i = 0; i <= n_ours; i++) m->head[i] = m->tail[i] = -1;
 
-        /* Check for status marker */
-        if (p[0] == '[' && p[2] == ']') {
-            if (p[1] == 'x' || p[1] == 'X') todo->status = STATUS_DONE;
-            else if (p[1] == '>') todo->status = STATUS_IN_PROGRESS;
-            else todo->status = STATUS_TODO;
-            p += 3;
-            while (*p == ' ') p++;
-            text_start = p;
+    for (size_t i = 0; i < n_ours; i++) {
+        TodoStatus o = (TodoStatus)ours->set.items[i].status;
+        long b = side_find(base, ours, i);
+        long t = side_find(theirs, ours, i);
+        int bs = b >= 0 ? base->set.items[b].status : -1;
+        int conflict = 0;
+
+        m->keep[i] = 1;
+        m->status[i] = (uint8_t)o;
+        if (t >= 0) {
+            m->status[i] = (uint8_t)merge_status(bs, o, (TodoStatus)theirs->set.items[t].status, &conflict);
+            if (conflict) {
+                merge_conflict(ours, i, "changed on both sides, kept the higher status");
+                conflicts++;
+            }
+        } else if (b >= 0 && bs == (int)o) {
+            m->keep[i] = 0;
+        } else if (b >= 0) {
+            merge_conflict(ours, i, "deleted in theirs but changed in ours, kept");
+            conflicts++;
         }
     }
 
-    /* Extract text */
-    len = strlen(text_start);
-    while (len > 0 && (text_start[len-1] == '\n' || text_start[len-1] == '\r')) len--;
+    size_t anchor = n_ours;
+    for (size_t i = 0; i < n_theirs; i++) {
+        long o = side_find(ours, theirs, i);
+        if (o >= 0) {
+            anchor = (size_t)o;
+            continue;
+        }
 
-    if (len > 0) {
-        todo->text = malloc(len + 1);
-        if (todo->text) {
-            memcpy(todo->text, text_start, len);
-            todo->text[len] = '\0';
-            todo->id = id;
+        long b = side_find(base, theirs, i);
+        if (b >= 0 && base->set.items[b].status == theirs->set.items[i].status) continue;
+        if (b >= 0) {
+            merge_conflict(theirs, i, "deleted in ours but changed in theirs, kept");
+            conflicts++;
+        }
+
+        m->next[i] = -1;
+        if (m->tail[anchor] < 0) m->head[anchor] = (long)i;
+        else m->next[m->tail[anchor]] = (long)i;
+        m->tail[anchor] = (long)i;
+    }
+
+    for (long t = m->head[n_ours]; t >= 0; t = m->next[t]) {
+        emit_item(out, NULL, theirs, (size_t)t, (TodoStatus)theirs->set.items[t].status);
+    }
+    for (size_t i = 0; i < n_ours; i++) {
+        if (m->keep[i]) emit_item(out, NULL, ours, i, (TodoStatus)m->status[i]);
+        for (long t = m->head[i]; t >= 0; t = m->next[t]) {
+            emit_item(out, NULL, theirs, (size_t)t, (TodoStatus)theirs->set.items[t].status);
         }
     }
+    return conflicts;
+}
+
+/* Three-way merge of paths[0..2], base, ours and theirs, in ours' order.
+ * An item theirs added goes after the nearest item before it in theirs
+ * that ours also has. An item deleted on one side and left alone on the
+ * other is deleted; one deleted on one side but changed on the other is
+ * kept. Such conflicts are resolved as described and reported on stderr.
+ * Returns 0 for a clean merge, 1 when there were conflicts and 2 on
+ * trouble, like git merge-file. */
+static int cmd_merge(const char **paths, Sink *out) {
+    Program all;
+    char err[64];
+    Side sides[3];
+
+    if (expr_compile(&all, "", err, sizeof(err)) < 0) return 2;
+    if (sides_open(sides, paths, 3, &all) < 0) {
+        expr_free(&all);
+        return 2;
+    }
+
+    size_t n_ours = sides[1].set.count;
+    size_t n_theirs = sides[2].set.count;
+    MergePlan m;
+    m.head = malloc(sizeof(long) * (n_ours + 1));
+    m.tail = malloc(sizeof(long) * (n_ours + 1));
+    m.next = malloc(sizeof(long) * (n_theirs ? n_theirs : 1));
+    m.keep = malloc(n_ours ? n_ours : 1);
+    m.status = malloc(n_ours ? n_ours : 1);
+
+    int rc = 0;
+    if (m.head && m.tail && m.next && m.keep && m.status) {
+        if (merge_sides(&sides[0], &sides[1], &sides[2], &m, out) > 0) rc = 1;
+    } else {
+        fprintf(stderr, "Failed to allocate memory\n");
+        rc = 2;
+    }
+
+    free(m.head);
+    free(m.tail);
+    free(m.next);
+    free(m.keep);
+    free(m.status);
+    for (int i = 0; i < 3; i++) side_close(&sides[i]);
+    expr_free(&all);
+    return rc;
+}
+
+/* --serve keeps parsed files in memory and answers queries on them over a
+ * Unix socket, so a prompt that runs "chop -iip FILE" on every refresh
+ * costs a round trip instead of a read and parse. The client is this same
+ * binary: it tries the socket first and does the work itself when nobody
+ * answers.
+ *
+ * A request is a ServeRequest followed by the absolute file path and the
+ * filter source. The reply is one byte, 'O' and then the output and a
+ * ServeEnd, or 'F' for "do it yourself", after which the daemon closes
+ * the connection. Both ends only talk to a peer running as the same user. */
+enum {
+    SERVE_FILTER,
+    SERVE_MARK,
+    SERVE_COUNT
+};
+
+typedef struct {
+    uint8_t mode;
+    uint8_t status;     /* new status for SERVE_MARK */
+    uint8_t uniq;
+    uint8_t sort;
+    uint8_t stats;      /* SERVE_COUNT: 0 total, 1 per status, 2 JSON */
+    uint8_t group;
+    uint8_t pad[2];
+    uint32_t path_len;
+    uint32_t where_len;
+    uint64_t offset;
+    uint64_t limit;
+} ServeRequest;
+
+/* Ends an 'O' reply. A reply cut short has none. */
+typedef struct {
+    char magic[4];      /* "chop" */
+    int32_t rc;         /* what the command returned */
+} ServeEnd;
+
+#define SERVE_CACHE 64
+#define SERVE_WHERE_MAX 65536
+
+/* A cached file. The list points into buf. */
+typedef struct {
+    char *path;
+    char *buf;
+    TodoList *list;
+    int wd;             /* inotify watch, -1 without */
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned long used; /* for least recently used eviction */
+} ServeFile;
+
+typedef struct {
+    ServeFile files[SERVE_CACHE];
+    size_t n;
+    int notify;         /* inotify descriptor, -1 without */
+    unsigned long clock;
+} ServeCache;
+
+/* The daemon is opt-in: without a $CHOP_SOCKET path, no chop serves or
+ * asks one */
+static int serve_path(struct sockaddr_un *addr) {
+    const char *env = getenv("CHOP_SOCKET");
+    if (!env || !*env) return -1;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", env);
+    return n > 0 && (size_t)n < sizeof(addr->sun_path) ? 0 : -1;
+}
+
+/* Whether the process on the other end runs as this user */
+static int peer_is_us(int fd) {
+    uid_t uid;
+#ifdef __linux__
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0) return 0;
+    uid = cred.uid;
+#else
+    gid_t gid;
+    if (getpeereid(fd, &uid, &gid) < 0) return 0;
+#endif
+    return uid == getuid();
+}
+
+/* Whether path is a socket this user owns, so another user cannot stand
+ * in for the daemon by binding the name first */
+static int our_socket(const char *path) {
+    struct stat st;
+    return lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) && st.st_uid == getuid();
+}
+
+static int serve_connect(void) {
+    struct sockaddr_un addr;
+    if (serve_path(&addr) < 0 || !our_socket(addr.sun_path)) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || !peer_is_us(fd)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
 }
 
-/* Helper to grow list */
-static int grow_list(TodoList *list) {
-    size_t new_cap = list->capacity * 2;
-    Todo *new_items = realloc(list->items, sizeof(Todo) * new_cap);
-    if (!new_items) return -1;
-    list->items = new_items;
-    list->capacity = new_cap;
+static int send_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
     return 0;
 }
 
-/* Read todos from a file handle into list */
-static TodoList *read_todos(FILE *in) {
-    TodoList *list = todolist_new();
-    if (!list) return NULL;
+static int recv_all(int fd, void *data, size_t len) {
+    char *p = data;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
 
-    char line[1024];
-    int id = 1;
-    while (fgets(line, sizeof(line), in)) {
-        if (list->count >= list->capacity) {
-            if (grow_list(list) < 0) {
-                todolist_free(list);
-                return NULL;
+static void serve_drop(ServeCache *cache, size_t i) {
+    ServeFile *f = &cache->files[i];
+    int shared = 0;
+
+    /* Two paths to one file share a watch */
+    for (size_t j = 0; j < cache->n; j++) {
+        if (j != i && cache->files[j].wd == f->wd) shared = 1;
+    }
+#ifdef __linux__
+    if (f->wd >= 0 && !shared) inotify_rm_watch(cache->notify, f->wd);
+#else
+    (void)shared;
+#endif
+    todolist_free(f->list);
+    free(f->buf);
+    free(f->path);
+    cache->files[i] = cache->files[--cache->n];
+}
+
+/* Forget every file behind the watches that reported a change */
+static void serve_notified(ServeCache *cache) {
+#ifdef __linux__
+    union {
+        struct inotify_event ev;
+        char buf[4096];
+    } u;
+    char *buf = u.buf;
+    ssize_t n;
+
+    while ((n = read(cache->notify, buf, sizeof(u))) > 0) {
+        for (char *p = buf; p < buf + n; ) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            for (size_t i = cache->n; i-- > 0; ) {
+                /* The kernel already removed a watch that reports IN_IGNORED */
+                if (cache->files[i].wd != ev->wd) continue;
+                if (ev->mask & IN_IGNORED) cache->files[i].wd = -1;
+                serve_drop(cache, i);
             }
+            p += sizeof(struct inotify_event) + ev->len;
         }
-
-        Todo *todo = &list->items[list->count];
-        memset(todo, 0, sizeof(Todo));
-        parse_todo_line(line, todo, id);
-        if (todo->text) id++;
-        list->count++;
     }
+#else
+    (void)cache;
+#endif
+}
 
-    return list;
+static int same_file(const ServeFile *f, const struct stat *st) {
+    return f->dev == st->st_dev && f->ino == st->st_ino && f->size == st->st_size &&
+           f->mtime.tv_sec == st->st_mtim.tv_sec && f->mtime.tv_nsec == st->st_mtim.tv_nsec;
 }
 
-/* Output all todos to a file handle */
-static void output_todos(TodoList *list, FILE *out) {
-    for (size_t i = 0; i < list->count; i++) {
-        Todo *todo = &list->items[i];
-        if (todo->text) {
-            fprintf(out, "- [%c] %s\n", status_to_char(todo->status), todo->text);
+/* Read and parse path into a new cache slot */
+static ServeFile *serve_load(ServeCache *cache, const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *buf = malloc(size ? size : 1);
+    int rc = buf ? recv_all(fd, buf, size) : -1;
+    close(fd);
+    if (rc < 0) {
+        free(buf);
+        return NULL;
+    }
+
+    Input in;
+    memset(&in, 0, sizeof(in));
+    in.map = buf;
+    in.map_len = size;
+    TodoList *list = read_todos(&in, NULL, NULL, NULL);
+    char *copy = strdup(path);
+    if (!list || !copy) {
+        todolist_free(list);
+        free(copy);
+        free(buf);
+        return NULL;
+    }
+
+    if (cache->n == SERVE_CACHE) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < cache->n; i++) {
+            if (cache->files[i].used < cache->files[oldest].used) oldest = i;
         }
+        serve_drop(cache, oldest);
+    }
+
+    ServeFile *f = &cache->files[cache->n++];
+    f->path = copy;
+    f->buf = buf;
+    f->list = list;
+    f->wd = -1;
+#ifdef __linux__
+    if (cache->notify >= 0) {
+        f->wd = inotify_add_watch(cache->notify, path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
     }
+#endif
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    f->size = st.st_size;
+    f->mtime = st.st_mtim;
+    return f;
 }
 
-/* Format/filter input to output */
-static int cmd_filter(FILE *in, FILE *out, int do_include, TodoStatus include_status,
-                      int do_exclude, TodoStatus exclude_status) {
-    TodoList *list = read_todos(in);
-    if (!list) {
-        fprintf(stderr, "Failed to allocate memory\n");
-        return 1;
+/* The parsed file at path. A stat guards against changes that inotify
+ * missed or could not see, such as a rename over the path. */
+static ServeFile *serve_get(ServeCache *cache, const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0) return NULL;
+
+    ServeFile *f = NULL;
+    for (size_t i = 0; i < cache->n; i++) {
+        if (strcmp(cache->files[i].path, path) != 0) continue;
+        if (same_file(&cache->files[i], &st)) f = &cache->files[i];
+        else serve_drop(cache, i);
+        break;
     }
 
-    for (size_t i = 0; i < list->count; i++) {
-        Todo *todo = &list->items[i];
-        if (todo->text) {
-            int show = 1;
-            if (do_include && todo->status != include_status) show = 0;
-            if (do_exclude && todo->status == exclude_status) show = 0;
-            if (show) {
-                fprintf(out, "- [%c] %s\n", status_to_char(todo->status), todo->text);
-            }
+    if (!f) f = serve_load(cache, path);
+    if (f) f->used = ++cache->clock;
+    return f;
+}
+
+typedef struct {
+    const Program *prog;
+    Counts counts;
+} ServeCount;
+
+static int count_matching(Todo *todo, Sink *out, void *ctx) {
+    ServeCount *c = ctx;
+    (void)out;
+    if (expr_match(c->prog, todo)) c->counts.by_status[todo->status]++;
+    return 0;
+}
+
+/* Answer one connection */
+static void serve_one(ServeCache *cache, int conn) {
+    ServeRequest req;
+    char *path = NULL;
+    char *where = NULL;
+    Program prog;
+    ServeFile *f = NULL;
+    int compiled = 0;
+    char err[128];
+
+    if (recv_all(conn, &req, sizeof(req)) == 0 && req.path_len > 0 && req.path_len < 4096 &&
+        req.where_len < SERVE_WHERE_MAX && req.mode <= SERVE_COUNT && req.status <= STATUS_IN_PROGRESS &&
+        req.sort <= SORT_ID && req.group <= GROUP_DUE) {
+        path = malloc(req.path_len + 1);
+        where = malloc(req.where_len + 1);
+    }
+    if (path && where && recv_all(conn, path, req.path_len) == 0 &&
+        recv_all(conn, where, req.where_len) == 0) {
+        path[req.path_len] = '\0';
+        where[req.where_len] = '\0';
+        compiled = expr_compile(&prog, where, err, sizeof(err)) == 0;
+        if (compiled) f = serve_get(cache, path);
+    }
+
+    Sink *out = malloc(sizeof(Sink));
+    if (out) {
+        sink_init_fd(out, conn);
+        sink_write(out, f ? "O" : "F", 1);
+    }
+    if (out && f) {
+        ServeEnd end = { { 'c', 'h', 'o', 'p' }, 0 };
+        Input in;
+        memset(&in, 0, sizeof(in));
+        in.list = f->list;
+        in.map = f->buf;
+        in.map_len = in.pos = (size_t)f->size;
+
+        Order order = { req.uniq, (SortKey)req.sort, (GroupKey)req.group, (size_t)req.offset, (size_t)req.limit };
+        if (req.mode == SERVE_FILTER) {
+            end.rc = cmd_filter(&in, out, 1, &prog, &order);
+        } else if (req.mode == SERVE_MARK) {
+            end.rc = cmd_status_stream(&in, out, 1, (TodoStatus)req.status, &prog);
+        } else {
+            ServeCount count;
+            memset(&count, 0, sizeof(count));
+            count.prog = &prog;
+            end.rc = stream_todos(&in, out, count_matching, &count);
+            print_counts(&count.counts, req.stats > 0, req.stats > 1, out);
         }
+        sink_write(out, &end, sizeof(end));
     }
+    if (out) sink_flush(out);
 
-    todolist_free(list);
-    return 0;
+    free(out);
+    if (compiled) expr_free(&prog);
+    free(path);
+    free(where);
 }
 
-/* Modify status in stream - all items or specific ID */
-static int cmd_status_stream(FILE *in, FILE *out, TodoStatus new_status, int target_id) {
-    TodoList *list = read_todos(in);
-    if (!list) {
-        fprintf(stderr, "Failed to allocate memory\n");
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig) {
+    (void)sig;
+    serve_stop = 1;
+}
+
+static int cmd_serve(void) {
+    struct sockaddr_un addr;
+    if (serve_path(&addr) < 0) {
+        fprintf(stderr, "No socket path: set CHOP_SOCKET\n");
         return 1;
     }
 
-    /* Apply status change - all items if target_id is 0, otherwise specific ID */
-    for (size_t i = 0; i < list->count; i++) {
-        if (list->items[i].text) {
-            if (target_id == 0 || list->items[i].id == target_id) {
-                list->items[i].status = new_status;
+    /* A socket nobody answers on is left over from a daemon that died.
+     * Anything that is not our socket is left alone. */
+    int live = serve_connect();
+    if (live >= 0) {
+        close(live);
+        fprintf(stderr, "Already serving on %s\n", addr.sun_path);
+        return 1;
+    }
+    if (our_socket(addr.sun_path)) unlink(addr.sun_path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t mask = umask(077);
+    int rc = sock < 0 ? -1 : bind(sock, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (rc < 0 || listen(sock, 16) < 0) {
+        fprintf(stderr, "Cannot listen on %s: %s\n", addr.sun_path, strerror(errno));
+        if (sock >= 0) close(sock);
+        return 1;
+    }
+
+    /* A client that goes away mid-reply must not take the daemon with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Stop cleanly on INT and TERM so the socket is removed */
+    struct sigaction stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = serve_signal;
+    sigemptyset(&stop.sa_mask);
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+
+    static ServeCache cache;
+    cache.notify = -1;
+#ifdef __linux__
+    cache.notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+
+    while (!serve_stop) {
+        struct pollfd fds[2] = { { sock, POLLIN, 0 }, { cache.notify, POLLIN, 0 } };
+        if (poll(fds, cache.notify >= 0 ? 2 : 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        /* Changes first, so a query sent after a write sees the write */
+        if (cache.notify >= 0 && (fds[1].revents & POLLIN)) serve_notified(&cache);
+        if (fds[0].revents & POLLIN) {
+            int conn = accept(sock, NULL, NULL);
+            if (conn < 0) continue;
+            if (!peer_is_us(conn)) {
+                close(conn);
+                continue;
             }
+            struct timeval tv = { 1, 0 };
+            setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            serve_one(&cache, conn);
+            close(conn);
         }
     }
 
-    output_todos(list, out);
-    todolist_free(list);
-    return 0;
+    close(sock);
+    unlink(addr.sun_path);
+    return serve_stop ? 0 : 1;
 }
 
-/* Modify status with fzf selection */
-static int cmd_status_fzf(FILE *in, FILE *out, TodoStatus new_status) {
-    TodoList *list = read_todos(in);
-    if (!list) {
-        fprintf(stderr, "Failed to allocate memory\n");
+/* Ask a running daemon to answer for file_path. Returns 1 when none did,
+ * or its reply was cut short or reports a failure, and the caller should
+ * do the work itself; otherwise 0 or -1 as the command would. The reply
+ * is read whole before any of it is written, so a slow reader such as a
+ * pager never holds up the daemon and a bad one is never half printed. */
+static int serve_client(const ServeRequest *base, const char *file_path, const char *where, Sink *out) {
+    int fd = serve_connect();
+    if (fd < 0) return 1;
+
+    char *path = realpath(file_path, NULL);
+    if (!path) {
+        close(fd);
         return 1;
     }
 
-    /* Build list of selectable todos */
-    FILE *fzf = popen("fzf", "w+");
-    if (!fzf) {
-        /* Try without popen read - use temp approach */
-        fzf = popen("fzf > /tmp/chop_fzf_out", "w");
-        if (!fzf) {
-            fprintf(stderr, "Failed to run fzf\n");
-            todolist_free(list);
-            return 1;
-        }
+    ServeRequest req = *base;
+    req.path_len = (uint32_t)strlen(path);
+    req.where_len = where ? (uint32_t)strlen(where) : 0;
+
+    /* A daemon that hangs up early is EPIPE and a local run, not a signal */
+    struct sigaction ignore, saved;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &saved);
+
+    char reply = 0;
+    struct timeval tv = { 5, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int ok = req.where_len < SERVE_WHERE_MAX &&
+             send_all(fd, &req, sizeof(req)) == 0 &&
+             send_all(fd, path, req.path_len) == 0 &&
+             send_all(fd, where, req.where_len) == 0 &&
+             recv_all(fd, &reply, 1) == 0 && reply == 'O';
+    sigaction(SIGPIPE, &saved, NULL);
+    free(path);
+    if (!ok) {
+        close(fd);
+        return 1;
+    }
 
-        /* Write todos to fzf */
-        for (size_t i = 0; i < list->count; i++) {
-            Todo *todo = &list->items[i];
-            if (todo->text) {
-                fprintf(fzf, "- [%c] %s\n", status_to_char(todo->status), todo->text);
+    char *buf = NULL;
+    size_t len = 0, cap = 0;
+    int rc = 0;
+    for (;;) {
+        if (len == cap) {
+            cap = cap ? cap * 2 : SINK_BUFSIZE;
+            char *grown = realloc(buf, cap);
+            if (!grown) {
+                rc = -1;
+                break;
             }
+            buf = grown;
         }
-        pclose(fzf);
-
-        /* Read selection */
-        FILE *fzf_out = fopen("/tmp/chop_fzf_out", "r");
-        if (fzf_out) {
-            char selected[1024];
-            while (fgets(selected, sizeof(selected), fzf_out)) {
-                /* Find matching todo by text */
-                size_t sel_len = strlen(selected);
-                while (sel_len > 0 && (selected[sel_len-1] == '\n' || selected[sel_len-1] == '\r')) {
-                    selected[--sel_len] = '\0';
-                }
-
-                for (size_t i = 0; i < list->count; i++) {
-                    Todo *todo = &list->items[i];
-                    if (todo->text) {
-                        char line[1024];
-                        snprintf(line, sizeof(line), "- [%c] %s", status_to_char(todo->status), todo->text);
-                        if (strcmp(line, selected) == 0) {
-                            todo->status = new_status;
-                            break;
-                        }
-                    }
-                }
-            }
-            fclose(fzf_out);
-            unlink("/tmp/chop_fzf_out");
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) rc = -1;
+        if (n <= 0) break;
+        len += (size_t)n;
+    }
+    close(fd);
+
+    ServeEnd end;
+    if (rc == 0) {
+        if (len < sizeof(end)) {
+            rc = 1;
+        } else {
+            len -= sizeof(end);
+            memcpy(&end, buf + len, sizeof(end));
+            if (memcmp(end.magic, "chop", 4) != 0 || end.rc != 0) rc = 1;
         }
-    } else {
-        pclose(fzf);
-        fprintf(stderr, "Failed to run fzf\n");
-        todolist_free(list);
-        return 1;
     }
+    if (rc == 0) rc = sink_write(out, buf, len);
+    free(buf);
+    return rc;
+}
 
-    output_todos(list, out);
-    todolist_free(list);
-    return 0;
+static void report_profile(void) {
+    prof_report(stderr);
 }
 
 int main(int argc, char **argv) {
@@ -258,11 +2909,31 @@ int main(int argc, char **argv) {
     int do_mark = 0;
     int use_fzf = 0;
     int do_write = 0;
+    int use_index = 0;
+    int follow = 0;
+    int do_count = 0;
+    int do_stats = 0;
+    int stats_json = 0;
+    int do_profile = 0;
+    int do_serve = 0;
+    int do_diff = 0;
+    int do_merge = 0;
+    Order order = ORDER_ALL;
+    int jobs_set = 0;
+    const char **files = calloc((size_t)argc, sizeof(char *));
+    size_t nfiles = 0;
+    int jobs = 1;
+    int result;
     const char *file_path = NULL;
+    const char *name_glob = NULL;
+    Where where = { NULL, 0 };
+    Program prog;
     TodoStatus include_status = STATUS_TODO;
     TodoStatus exclude_status = STATUS_TODO;
     TodoStatus mark_status = STATUS_TODO;
 
+    prof_init();
+
     /* Parse options */
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--version") == 0) {
@@ -275,6 +2946,10 @@ int main(int argc, char **argv) {
             use_fzf = 1;
         } else if (strcmp(argv[i], "-w") == 0 || strcmp(argv[i], "--write") == 0) {
             do_write = 1;
+        } else if (strcmp(argv[i], "--index") == 0) {
+            use_index = 1;
+        } else if (strcmp(argv[i], "-F") == 0 || strcmp(argv[i], "--follow") == 0) {
+            follow = 1;
         } else if (strcmp(argv[i], "-f") == 0) {
             if (i + 1 >= argc) {
                 fprintf(stderr, "Missing argument for -f\n");
@@ -283,6 +2958,59 @@ int main(int argc, char **argv) {
             file_path = argv[++i];
         } else if (strncmp(argv[i], "--file=", 7) == 0) {
             file_path = argv[i] + 7;
+        } else if (strcmp(argv[i], "-j") == 0 || strncmp(argv[i], "--jobs=", 7) == 0) {
+            const char *arg = argv[i][1] == 'j' ? argv[++i] : argv[i] + 7;
+            if (!arg || parse_jobs(arg, &jobs) < 0) {
+                fprintf(stderr, "Invalid job count: %s\n", arg ? arg : "(missing)");
+                return 1;
+            }
+            jobs_set = 1;
+        } else if (strncmp(argv[i], "--name=", 7) == 0) {
+            name_glob = argv[i] + 7;
+        } else if (strncmp(argv[i], "--limit=", 8) == 0 || strncmp(argv[i], "--head=", 7) == 0) {
+            const char *arg = strchr(argv[i], '=') + 1;
+            if (parse_count(arg, &order.limit) < 0) {
+                fprintf(stderr, "Invalid limit: %s\n", arg);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--offset=", 9) == 0) {
+            if (parse_count(argv[i] + 9, &order.offset) < 0) {
+                fprintf(stderr, "Invalid offset: %s\n", argv[i] + 9);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--uniq") == 0) {
+            order.uniq = 1;
+        } else if (strncmp(argv[i], "--sort=", 7) == 0) {
+            const char *key = argv[i] + 7;
+            if (strcmp(key, "status") == 0) order.sort = SORT_STATUS;
+            else if (strcmp(key, "text") == 0) order.sort = SORT_TEXT;
+            else if (strcmp(key, "id") == 0) order.sort = SORT_ID;
+            else {
+                fprintf(stderr, "Invalid sort key: %s\n", key);
+                return 1;
+            }
+        } else if (strncmp(argv[i], "--group-by=", 11) == 0) {
+            const char *key = argv[i] + 11;
+            if (strcmp(key, "tag") == 0) order.group = GROUP_TAG;
+            else if (strcmp(key, "owner") == 0) order.group = GROUP_OWNER;
+            else if (strcmp(key, "due") == 0) order.group = GROUP_DUE;
+            else {
+                fprintf(stderr, "Invalid group key: %s\n", key);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--diff") == 0) {
+            do_diff = 1;
+        } else if (strcmp(argv[i], "--merge") == 0) {
+            do_merge = 1;
+        } else if (strcmp(argv[i], "--serve") == 0) {
+            do_serve = 1;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            do_profile = 1;
+        } else if (strcmp(argv[i], "--count") == 0) {
+            do_count = 1;
+        } else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=json") == 0) {
+            do_stats = 1;
+            stats_json = argv[i][7] == '=';
         } else if (strncmp(argv[i], "--include=", 10) == 0) {
             if (parse_status_code(argv[i] + 10, &include_status) < 0) {
                 fprintf(stderr, "Invalid include status: %s\n", argv[i] + 10);
@@ -295,6 +3023,25 @@ int main(int argc, char **argv) {
                 return 1;
             }
             do_exclude = 1;
+        } else if (strncmp(argv[i], "--id=", 5) == 0) {
+            where_add(&where, "id:", argv[i] + 5, 1, "");
+        } else if (strncmp(argv[i], "--match=", 8) == 0) {
+            where_add(&where, "has:", argv[i] + 8, 1, "");
+        } else if (strncmp(argv[i], "--regex=", 8) == 0) {
+            where_add(&where, "re:", argv[i] + 8, 1, "");
+        } else if (strncmp(argv[i], "--tag=", 6) == 0) {
+            where_add(&where, "tag:", argv[i] + 6, 1, "");
+        } else if (strncmp(argv[i], "--owner=", 8) == 0) {
+            where_add(&where, "owner:", argv[i] + 8, 1, "");
+        } else if (strncmp(argv[i], "--due=", 6) == 0) {
+            where_add(&where, "due:", argv[i] + 6, 1, "");
+        } else if (strcmp(argv[i], "-e") == 0 || strncmp(argv[i], "--where=", 8) == 0) {
+            const char *arg = argv[i][1] == 'e' ? argv[++i] : argv[i] + 8;
+            if (!arg) {
+                fprintf(stderr, "Missing argument for -e\n");
+                return 1;
+            }
+            where_add(&where, "(", arg, 0, ")");
         } else if (strncmp(argv[i], "--mark=", 7) == 0) {
             if (parse_status_code(argv[i] + 7, &mark_status) < 0) {
                 fprintf(stderr, "Invalid mark status: %s\n", argv[i] + 7);
@@ -332,78 +3079,273 @@ int main(int argc, char **argv) {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
             usage(argv[0]);
             return 1;
-        } else {
-            fprintf(stderr, "Unexpected argument: %s\n", argv[i]);
-            usage(argv[0]);
+        } else if (files) {
+            files[nfiles++] = argv[i];
+        }
+    }
+
+    if (do_profile) atexit(report_profile);
+    if (do_serve) return cmd_serve();
+    if (do_include) where_add(&where, "is:", status_to_str(include_status), 0, "");
+    if (do_exclude) where_add(&where, "not is:", status_to_str(exclude_status), 0, "");
+
+    /* Every filter option ends up in one program, compiled once */
+    char err[256];
+    if (expr_compile(&prog, where.src ? where.src : "", err, sizeof(err)) < 0) {
+        fprintf(stderr, "Invalid filter '%s': %s\n", where.src, err);
+        free(where.src);
+        return 1;
+    }
+
+    if (!files) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        return 1;
+    }
+
+    /* --diff A B and --merge BASE OURS THEIRS take their files as given */
+    if (do_diff || do_merge) {
+        if (do_diff && do_merge) {
+            fprintf(stderr, "--diff and --merge cannot be combined\n");
+            return 1;
+        }
+        if (nfiles != (do_diff ? 2u : 3u) || file_path) {
+            fprintf(stderr, do_diff ? "--diff takes two files: A B\n" : "--merge takes three files: BASE OURS THEIRS\n");
             return 1;
         }
+        if (do_mark || use_fzf || follow || use_index || do_count || do_stats ||
+            order.uniq || order.sort != SORT_NONE || order.group || order.offset > 0 || order.limit != SIZE_MAX ||
+            (do_diff && do_write) || (do_merge && where.src)) {
+            fprintf(stderr, "--diff takes only filters and --merge only --write\n");
+            return 1;
+        }
+        free(where.src);
+
+        /* A merge written back replaces OURS */
+        static Sink diff_out;
+        Replace replace;
+        sink_init_fd(&diff_out, STDOUT_FILENO);
+        if (do_write) {
+            if (replace_open(&replace, files[1]) < 0) {
+                fprintf(stderr, "Cannot create temporary file for %s: %s\n", files[1], strerror(errno));
+                replace_close(&replace);
+                return 2;
+            }
+            sink_init_fd(&diff_out, replace.fd);
+        }
+
+        result = do_diff ? cmd_diff(files[0], files[1], &prog, &diff_out) : cmd_merge(files, &diff_out);
+        if (sink_flush(&diff_out) < 0) {
+            fprintf(stderr, "Write error: %s\n", strerror(diff_out.err));
+            result = 2;
+        }
+        /* A merge with conflicts still has a result to write */
+        if (do_write) {
+            if (result < 2 && replace_commit(&replace) < 0) {
+                fprintf(stderr, "Cannot write to file: %s: %s\n", files[1], strerror(errno));
+                result = 2;
+            }
+            replace_close(&replace);
+        }
+        free(files);
+        expr_free(&prog);
+        return result;
     }
 
-    /* Validate mutually exclusive flags */
-    if (do_include && do_exclude) {
-        fprintf(stderr, "Cannot use --include and --exclude together\n");
+    /* Positional arguments are files or directories to work through. A
+     * single plain file is the same as -f FILE. */
+    PathList paths = { NULL, 0, 0 };
+    int batch = nfiles > 1 || (nfiles == 1 && file_path);
+    if (file_path && nfiles > 0 && paths_collect(&paths, file_path, NULL, 1) < 0) return 1;
+    for (size_t i = 0; i < nfiles; i++) {
+        struct stat st;
+        if (stat(files[i], &st) == 0 && S_ISDIR(st.st_mode)) batch = 1;
+        if (paths_collect(&paths, files[i], name_glob, 1) < 0) return 1;
+    }
+    free(files);
+    if (nfiles > 0 && !batch) file_path = paths.paths[0];
+
+    if ((order.uniq || order.sort != SORT_NONE) && (do_mark || follow || do_count || do_stats)) {
+        fprintf(stderr, "--uniq and --sort cannot be combined with --mark, --follow, --count or --stats\n");
+        return 1;
+    }
+    if (order.group && (do_mark || do_write || follow || do_stats)) {
+        fprintf(stderr, "--group-by cannot be combined with --mark, --write, --follow or --stats\n");
+        return 1;
+    }
+    /* -w would save only the window and drop every other item */
+    if ((order.offset > 0 || order.limit != SIZE_MAX) && (do_mark || do_write || do_count || do_stats)) {
+        fprintf(stderr, "--limit and --offset cannot be combined with --mark, --write, --count or --stats\n");
         return 1;
     }
+
+    /* Read-only queries on one file go to a --serve at $CHOP_SOCKET, if set */
+    int counting = do_count || do_stats;
+    if (!batch && file_path && !do_write && !use_fzf && !follow && !use_index && !do_profile &&
+        !(counting && (do_mark || order.group))) {
+        ServeRequest req;
+        memset(&req, 0, sizeof(req));
+        req.mode = counting ? SERVE_COUNT : do_mark ? SERVE_MARK : SERVE_FILTER;
+        req.status = (uint8_t)mark_status;
+        req.uniq = (uint8_t)order.uniq;
+        req.sort = (uint8_t)order.sort;
+        req.group = (uint8_t)order.group;
+        req.offset = order.offset;
+        req.limit = order.limit;
+        req.stats = (uint8_t)(do_stats + stats_json);
+
+        static Sink served;
+        sink_init_fd(&served, STDOUT_FILENO);
+        result = serve_client(&req, file_path, where.src, &served);
+        if (result <= 0) {
+            if (sink_flush(&served) < 0 || result < 0) {
+                fprintf(stderr, "Write error: %s\n", strerror(served.err ? served.err : errno));
+                result = 1;
+            }
+            free(where.src);
+            expr_free(&prog);
+            paths_free(&paths);
+            return result;
+        }
+    }
+    free(where.src);
+
+    /* Counting only reads, so any number of files can be taken at once */
+    if (do_count || do_stats) {
+        if (do_mark || do_write || use_fzf || follow) {
+            fprintf(stderr, "--count and --stats cannot be combined with --mark, --write, --fzf or --follow\n");
+            return 1;
+        }
+        if (file_path && !paths.n && paths_add(&paths, file_path) < 0) return 1;
+        if (!jobs_set) parse_jobs("0", &jobs);
+
+        static Sink counts_out;
+        sink_init_fd(&counts_out, STDOUT_FILENO);
+        if (order.group) {
+            result = cmd_group_count((const char **)paths.paths, paths.n, &prog, order.group, &counts_out);
+        } else {
+            result = cmd_count((const char **)paths.paths, paths.n, jobs, &prog, do_stats, stats_json, &counts_out);
+        }
+        if (sink_flush(&counts_out) < 0) {
+            fprintf(stderr, "Write error: %s\n", strerror(counts_out.err));
+            result = 1;
+        }
+        expr_free(&prog);
+        paths_free(&paths);
+        return result;
+    }
+
+    if (batch) {
+        if (use_fzf || follow || use_index) {
+            fprintf(stderr, "--fzf, --follow and --index take a single file\n");
+            return 1;
+        }
+        if (!jobs_set) parse_jobs("0", &jobs);
+
+        static Sink batch_out;
+        sink_init_fd(&batch_out, STDOUT_FILENO);
+        result = cmd_batch(&paths, jobs, &prog, &order, do_mark, mark_status, do_write, &batch_out);
+        if (sink_flush(&batch_out) < 0) {
+            fprintf(stderr, "Write error: %s\n", strerror(batch_out.err));
+            result = 1;
+        }
+        expr_free(&prog);
+        paths_free(&paths);
+        return result;
+    }
+
+    /* Validate mutually exclusive flags */
     if (do_write && !file_path) {
         fprintf(stderr, "--write requires --file\n");
         return 1;
     }
+    if (follow && !file_path) {
+        fprintf(stderr, "--follow requires --file\n");
+        return 1;
+    }
+    if (follow && (do_write || use_fzf)) {
+        fprintf(stderr, "--follow cannot be combined with --write or --fzf\n");
+        return 1;
+    }
+
+    /* A mark that only flips status bytes can skip the rewrite entirely */
+    if (do_write && do_mark && !use_fzf) {
+        result = mark_in_place(file_path, mark_status, &prog);
+        if (result <= 0) {
+            if (result < 0) fprintf(stderr, "Cannot write to file: %s: %s\n", file_path, strerror(errno));
+            expr_free(&prog);
+            return result < 0;
+        }
+    }
 
     /* Set up input/output */
-    FILE *in = stdin;
-    FILE *out = stdout;
-    int result;
+    FILE *in_file = stdin;
+    static Sink out;
+    Replace replace;
+    TodoIndex index;
+    Input in;
 
     if (file_path) {
-        in = fopen(file_path, "r");
-        if (!in) {
+        in_file = fopen(file_path, "r");
+        if (!in_file) {
             fprintf(stderr, "Cannot open file: %s\n", file_path);
             return 1;
         }
     }
+    if (input_open(&in, in_file) < 0) {
+        fprintf(stderr, "Failed to allocate memory\n");
+        if (file_path) fclose(in_file);
+        return 1;
+    }
 
-    /* For write mode, we need to buffer output then write to file */
-    FILE *out_buffer = NULL;
+    index_init(&index);
+    if (follow) {
+        in.follow = file_path;
+    } else if (use_index && file_path && in.map) {
+        index_sync(&index, file_path, &in);
+    }
+
+    /* For write mode, output goes straight into the replacement file */
+    sink_init_fd(&out, STDOUT_FILENO);
     if (do_write) {
-        out_buffer = tmpfile();
-        if (!out_buffer) {
-            fprintf(stderr, "Cannot create temporary file\n");
-            if (file_path) fclose(in);
+        if (replace_open(&replace, file_path) < 0) {
+            fprintf(stderr, "Cannot create temporary file for %s: %s\n", file_path, strerror(errno));
+            replace_close(&replace);
+            input_close(&in);
+            fclose(in_file);
             return 1;
         }
-        out = out_buffer;
+        sink_init_fd(&out, replace.fd);
     }
 
     /* Execute based on flags */
     if (do_mark) {
         if (use_fzf) {
-            result = cmd_status_fzf(in, out, mark_status);
+            result = cmd_status_fzf(&in, &out, mark_status, &prog);
         } else {
-            result = cmd_status_stream(in, out, mark_status, 0);
+            result = cmd_status_stream(&in, &out, jobs, mark_status, &prog);
         }
     } else {
-        result = cmd_filter(in, out, do_include, include_status, do_exclude, exclude_status);
+        result = cmd_filter(&in, &out, jobs, &prog, &order);
     }
 
-    if (file_path) fclose(in);
+    if (sink_flush(&out) < 0) {
+        fprintf(stderr, "Write error: %s\n", strerror(out.err));
+        result = 1;
+    }
 
-    /* Write buffer back to file if requested */
-    if (do_write && result == 0) {
-        rewind(out_buffer);
-        FILE *out_file = fopen(file_path, "w");
-        if (!out_file) {
-            fprintf(stderr, "Cannot write to file: %s\n", file_path);
-            fclose(out_buffer);
-            return 1;
-        }
-        char buf[4096];
-        size_t n;
-        while ((n = fread(buf, 1, sizeof(buf), out_buffer)) > 0) {
-            fwrite(buf, 1, n, out_file);
+    input_close(&in);
+    index_free(&index);
+    if (file_path) fclose(in_file);
+
+    /* Swap the new contents in; on failure the original is untouched */
+    if (do_write) {
+        if (result == 0 && replace_commit(&replace) < 0) {
+            fprintf(stderr, "Cannot write to file: %s: %s\n", file_path, strerror(errno));
+            result = 1;
         }
-        fclose(out_file);
+        replace_close(&replace);
     }
 
-    if (out_buffer) fclose(out_buffer);
+    expr_free(&prog);
     return result;
 }
@@ -0,0 +1,117 @@
+#include "match.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static int range_cmp(const void *a, const void *b) {
+    const IdRange *x = a;
+    const IdRange *y = b;
+    return (x->lo > y->lo) - (x->lo < y->lo);
+}
+
+static int parse_id(const char *s, char **end, int *id) {
+    errno = 0;
+    long n = strtol(s, end, 10);
+    if (*end == s || errno || n < 1 || n > 0x7fffffff) return -1;
+    *id = (int)n;
+    return 0;
+}
+
+int idset_parse(IdSet *set, const char *spec) {
+    size_t cap = 1;
+    for (const char *p = spec; *p; p++) {
+        if (*p == ',') cap++;
+    }
+
+    set->ranges = malloc(sizeof(IdRange) * cap);
+    set->count = 0;
+    if (!set->ranges) return -1;
+
+    const char *p = spec;
+    for (;;) {
+        char *end;
+        IdRange r;
+
+        if (parse_id(p, &end, &r.lo) < 0) goto fail;
+        r.hi = r.lo;
+        if (*end == '-') {
+            if (parse_id(end + 1, &end, &r.hi) < 0 || r.hi < r.lo) goto fail;
+        }
+        set->ranges[set->count++] = r;
+
+        if (*end == '\0') break;
+        if (*end != ',') goto fail;
+        p = end + 1;
+    }
+
+    /* Sort and merge so lookups can binary search */
+    qsort(set->ranges, set->count, sizeof(IdRange), range_cmp);
+    size_t n = 0;
+    for (size_t i = 0; i < set->count; i++) {
+        if (n > 0 && set->ranges[i].lo <= set->ranges[n - 1].hi + 1) {
+            if (set->ranges[i].hi > set->ranges[n - 1].hi) {
+                set->ranges[n - 1].hi = set->ranges[i].hi;
+            }
+        } else {
+            set->ranges[n++] = set->ranges[i];
+        }
+    }
+    set->count = n;
+    return 0;
+
+fail:
+    idset_free(set);
+    return -1;
+}
+
+int idset_contains(const IdSet *set, int id) {
+    size_t lo = 0;
+    size_t hi = set->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (id < set->ranges[mid].lo) hi = mid;
+        else if (id > set->ranges[mid].hi) lo = mid + 1;
+        else return 1;
+    }
+    return 0;
+}
+
+void idset_free(IdSet *set) {
+    free(set->ranges);
+    set->ranges = NULL;
+    set->count = 0;
+}
+
+int text_contains(const char *text, size_t len, const char *needle, size_t needle_len) {
+    if (needle_len == 0) return 1;
+
+    const char *p = text;
+    const char *last = text + len;
+    while ((size_t)(last - p) >= needle_len) {
+        p = memchr(p, needle[0], (size_t)(last - p) - needle_len + 1);
+        if (!p) return 0;
+        if (memcmp(p, needle, needle_len) == 0) return 1;
+        p++;
+    }
+    return 0;
+}
+
+int text_regex(const regex_t *re, const char *text, size_t len) {
+#ifdef REG_STARTEND
+    regmatch_t m;
+    m.rm_so = 0;
+    m.rm_eo = (regoff_t)len;
+    return regexec(re, text, 1, &m, REG_STARTEND) == 0;
+#else
+    /* No way to bound the match; make a terminated copy */
+    char small[512];
+    char *copy = len < sizeof(small) ? small : malloc(len + 1);
+    if (!copy) return 0;
+    memcpy(copy, text, len);
+    copy[len] = '\0';
+    int rc = regexec(re, copy, 0, NULL, 0) == 0;
+    if (copy != small) free(copy);
+    return rc;
+#endif
+}
@@ -0,0 +1,32 @@
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stddef.h>
+#include <regex.h>
+
+/* Matching primitives for picking items out of a stream. Text arguments are
+ * views (pointer and length), as found in Todo. */
+
+typedef struct {
+    int lo;
+    int hi;
+} IdRange;
+
+/* Sorted, non-overlapping id ranges */
+typedef struct {
+    IdRange *ranges;
+    size_t count;
+} IdSet;
+
+/* Parse "3,7,100-250" into set; -1 on malformed input */
+int idset_parse(IdSet *set, const char *spec);
+int idset_contains(const IdSet *set, int id);
+void idset_free(IdSet *set);
+
+/* Substring test without needing NUL-terminated text */
+int text_contains(const char *text, size_t len, const char *needle, size_t needle_len);
+
+/* regexec over a view. re must have been compiled with REG_NOSUB. */
+int text_regex(const regex_t *re, const char *text, size_t len);
+
+#endif
@@ -0,0 +1,72 @@
+#include <string.h>
+#include <time.h>
+#include "prof.h"
+
+#ifdef CHOP_PROFILE
+__thread Profile prof_local;
+
+static Profile totals;
+
+static uint64_t start_ticks;
+static double start_secs;
+
+static double wall(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void prof_init(void) {
+    start_secs = wall();
+    start_ticks = prof_now();
+}
+
+void prof_flush(void) {
+    for (int i = 0; i < PROF_NCOUNTERS; i++) {
+        __sync_fetch_and_add(&totals.counters[i], prof_local.counters[i]);
+    }
+    for (int i = 0; i < PROF_NPHASES; i++) {
+        __sync_fetch_and_add(&totals.ticks[i], prof_local.ticks[i]);
+    }
+    memset(&prof_local, 0, sizeof(prof_local));
+}
+
+void prof_report(FILE *out) {
+    static const char *counters[PROF_NCOUNTERS] = {
+        "bytes in", "bytes out", "lines", "todo lines", "raw lines",
+        "allocations", "read calls", "write calls",
+    };
+    static const char *phases[PROF_NPHASES] = { "read", "parse", "filter", "write" };
+
+    prof_flush();
+
+    /* Ticks per second, measured over the whole run */
+    double secs = wall() - start_secs;
+    uint64_t ticks = prof_now() - start_ticks;
+    double rate = secs > 0 && ticks > 0 ? ticks / secs : 1e9;
+
+    fprintf(out, "chop profile:\n");
+    for (int i = 0; i < PROF_NCOUNTERS; i++) {
+        fprintf(out, "  %-12s %14llu\n", counters[i], (unsigned long long)totals.counters[i]);
+    }
+
+    double timed = 0;
+    for (int i = 0; i < PROF_NPHASES; i++) {
+        double t = totals.ticks[i] / rate;
+        timed += t;
+        fprintf(out, "  %-12s %14.6fs\n", phases[i], t);
+    }
+    fprintf(out, "  %-12s %14.6fs\n", "other", secs > timed ? secs - timed : 0);
+    fprintf(out, "  %-12s %14.6fs\n", "total", secs);
+}
+#else
+void prof_init(void) {
+}
+
+void prof_flush(void) {
+}
+
+void prof_report(FILE *out) {
+    fprintf(out, "chop: built without profiling; rebuild with make CPPFLAGS=-DCHOP_PROFILE\n");
+}
+#endif
@@ -0,0 +1,71 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Hot-path counters and phase timers. They only exist in builds made with
+ * -DCHOP_PROFILE (make CPPFLAGS=-DCHOP_PROFILE); otherwise every macro
+ * below expands to nothing and costs nothing. Each thread counts into its
+ * own copy, so the hot path never takes a lock or an atomic; a thread
+ * folds its copy into the totals with prof_flush before it exits. */
+
+enum {
+    PROF_BYTES_IN,
+    PROF_BYTES_OUT,
+    PROF_LINES,
+    PROF_TODOS,         /* lines that became todos */
+    PROF_RAW,           /* blank lines, kept or dropped as is */
+    PROF_ALLOCS,        /* heap allocations and reallocations */
+    PROF_READS,         /* read(2) calls */
+    PROF_WRITES,        /* write(2) calls */
+    PROF_NCOUNTERS
+};
+
+/* With several threads, phase times add up across them */
+enum {
+    PHASE_READ,         /* reading and splitting input into lines */
+    PHASE_PARSE,
+    PHASE_FILTER,
+    PHASE_WRITE,
+    PROF_NPHASES
+};
+
+#ifdef CHOP_PROFILE
+#include <time.h>
+
+typedef struct {
+    uint64_t counters[PROF_NCOUNTERS];
+    uint64_t ticks[PROF_NPHASES];
+} Profile;
+
+extern __thread Profile prof_local;
+
+/* The cycle counter where there is a cheap one; prof_report converts */
+static inline uint64_t prof_now(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+#define PROF_COUNT(counter, n) (prof_local.counters[counter] += (uint64_t)(n))
+#define PROF_BEGIN(var) uint64_t var = prof_now()
+#define PROF_END(phase, var) (prof_local.ticks[phase] += prof_now() - (var))
+#else
+#define PROF_COUNT(counter, n) ((void)0)
+#define PROF_BEGIN(var) ((void)0)
+#define PROF_END(phase, var) ((void)0)
+#endif
+
+/* Start the clock that phase times are calibrated against */
+void prof_init(void);
+/* Add this thread's counts to the totals */
+void prof_flush(void);
+/* Print the counters, or a note that this build has none */
+void prof_report(FILE *out);
+
+#endif
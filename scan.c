@@ -0,0 +1,150 @@
+#include "scan.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    const char *name;
+    size_t (*newline)(const char *p, size_t n);
+    size_t (*newlines)(const char *p, size_t n, size_t *out, size_t max);
+} ScanKernel;
+
+static size_t newline_portable(const char *p, size_t n) {
+    const char *nl = memchr(p, '\n', n);
+    return nl ? (size_t)(nl - p) : n;
+}
+
+static size_t newlines_portable(const char *p, size_t n, size_t *out, size_t max) {
+    size_t count = 0;
+    size_t i = 0;
+
+    while (count < max && i < n) {
+        i += newline_portable(p + i, n - i);
+        if (i == n) break;
+        out[count++] = i++;
+    }
+    return count;
+}
+
+static const ScanKernel kernel_portable = { "portable", newline_portable, newlines_portable };
+
+#ifdef SCAN_X86
+/* Finish the last partial block of p from offset i with a narrower kernel */
+static size_t scan_tail(size_t (*newlines)(const char *, size_t, size_t *, size_t),
+                        const char *p, size_t n, size_t i, size_t *out, size_t max) {
+    size_t count = newlines(p + i, n - i, out, max);
+    for (size_t k = 0; k < count; k++) out[k] += i;
+    return count;
+}
+
+/* Drain the newline bits of one block into out, returning once it is full */
+#define DRAIN_MASK(m, base)                                 \
+    while (m) {                                             \
+        out[count++] = (base) + (size_t)__builtin_ctz(m);  \
+        if (count == max) return count;                     \
+        m &= m - 1;                                         \
+    }
+
+__attribute__((target("sse2")))
+static size_t newline_sse2(const char *p, size_t n) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i + newline_portable(p + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static size_t newlines_sse2(const char *p, size_t n, size_t *out, size_t max) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+
+    if (max == 0) return 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        DRAIN_MASK(m, i);
+    }
+    return count + scan_tail(newlines_portable, p, n, i, out + count, max - count);
+}
+
+__attribute__((target("avx2")))
+static size_t newline_avx2(const char *p, size_t n) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    return i + newline_sse2(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t newlines_avx2(const char *p, size_t n, size_t *out, size_t max) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+
+    if (max == 0) return 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        DRAIN_MASK(m, i);
+    }
+    return count + scan_tail(newlines_sse2, p, n, i, out + count, max - count);
+}
+
+static const ScanKernel kernel_sse2 = { "sse2", newline_sse2, newlines_sse2 };
+static const ScanKernel kernel_avx2 = { "avx2", newline_avx2, newlines_avx2 };
+#endif
+
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+static const ScanKernel *kernel;
+
+/* CHOP_SCAN=portable|sse2 forces a narrower kernel for testing */
+static void scan_choose(void) {
+    const char *force = getenv("CHOP_SCAN");
+    const ScanKernel *best = &kernel_portable;
+
+#ifdef SCAN_X86
+    if (!(force && strcmp(force, "portable") == 0)) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && !(force && strcmp(force, "sse2") == 0)) {
+            best = &kernel_avx2;
+        } else if (__builtin_cpu_supports("sse2")) {
+            best = &kernel_sse2;
+        }
+    }
+#endif
+    (void)force;
+    kernel = best;
+}
+
+/* The first call may come from several -j workers at once */
+static const ScanKernel *scan_select(void) {
+    pthread_once(&kernel_once, scan_choose);
+    return kernel;
+}
+
+size_t scan_newline(const char *p, size_t n) {
+    return scan_select()->newline(p, n);
+}
+
+size_t scan_newlines(const char *p, size_t n, size_t *out, size_t max) {
+    return scan_select()->newlines(p, n, out, max);
+}
+
+const char *scan_kernel(void) {
+    return scan_select()->name;
+}
@@ -0,0 +1,45 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "chop.h"
+
+/* Vectorized scanning kernels. The implementation (AVX2, SSE2 or portable)
+ * is picked on first use from what the running CPU supports. */
+
+/* Offset of the first newline in p[0..n), or n if there is none */
+size_t scan_newline(const char *p, size_t n);
+
+/* Store the offsets of up to max newlines in p[0..n) into out, ascending.
+ * Returns how many were found; fewer than max means p was exhausted. */
+size_t scan_newlines(const char *p, size_t n, size_t *out, size_t max);
+
+/* Name of the kernel in use, for diagnostics */
+const char *scan_kernel(void);
+
+/* Recognise a canonical "- [c] " prefix with any of the -, * and + bullets
+ * using one masked 8-byte compare. Returns the prefix length with *status
+ * set, or 0 when the line has to go through the general parser. */
+static inline size_t scan_marker(const char *p, size_t n, TodoStatus *status) {
+    static const unsigned char mask_bytes[8] = { 0, 0xff, 0xff, 0, 0xff, 0xff, 0, 0 };
+    static const unsigned char want_bytes[8] = { 0, ' ', '[', 0, ']', ' ', 0, 0 };
+    uint64_t word, mask, want;
+
+    if (n < 8) return 0;
+    memcpy(&word, p, 8);
+    memcpy(&mask, mask_bytes, 8);
+    memcpy(&want, want_bytes, 8);
+    if ((word & mask) != want) return 0;
+    if (p[0] != '-' && p[0] != '*' && p[0] != '+') return 0;
+
+    switch (p[3]) {
+        case 'x': case 'X': *status = STATUS_DONE; break;
+        case '>': *status = STATUS_IN_PROGRESS; break;
+        default: *status = STATUS_TODO; break;
+    }
+    return 6;
+}
+
+#endif
@@ -0,0 +1,326 @@
+#!/bin/sh
+# Regression tests for the chop CLI: sh tests/run.sh [path/to/chop]
+
+CHOP=${1:-./chop}
+case $CHOP in
+/*) ;;
+*) CHOP=$PWD/$CHOP ;;
+esac
+
+# Never hand queries to a daemon the user happens to be running
+CHOP_SOCKET=
+export CHOP_SOCKET
+
+T=$(mktemp -d) || exit 1
+trap 'rm -rf "$T"' EXIT
+cd "$T" || exit 1
+
+pass=0
+fail=0
+
+ok() {
+    pass=$((pass + 1))
+}
+
+not_ok() {
+    fail=$((fail + 1))
+    echo "FAIL: $1"
+}
+
+# check NAME EXPECTED ACTUAL
+check() {
+    if [ "$2" = "$3" ]; then
+        ok
+    else
+        not_ok "$1"
+        printf '  expected: %s\n  actual:   %s\n' "$2" "$3"
+    fi
+}
+
+# Piped input goes through the chunked line reader; tr shows stray CRs
+check "CRLF line ends are dropped" "- [ ] a
+- [x] b" "$(printf -- '- [ ] a\r\n- [x] b\r\n' | cat | "$CHOP" | tr '\r' R)"
+check "a last line without a newline is kept" "- [ ] a
+- [x] b" "$(printf -- '- [ ] a\n- [x] b' | cat | "$CHOP")"
+
+# A line longer than the 64 KB read buffer stays one line
+awk 'BEGIN { s = "x"; while (length(s) < 70000) s = s s; print s; print "- [ ] short" }' > long.txt
+check "a 128 KB line is one todo" "131078
+11" "$(cat long.txt | "$CHOP" | awk '{ print length($0) }')"
+check "a 128 KB line is one todo with -f" "131078
+11" "$("$CHOP" -f long.txt | awk '{ print length($0) }')"
+
+# Other bullets and statuses fall back from the canonical fast path
+printf -- '* [x] b\r\n+ [>] c\n  - [X] d\n- e\nplain\n\n- [ ] f' > marks.txt
+check "markers are classified" "- [x] b
+- [>] c
+- [x] d
+- [ ] e
+- [ ] plain
+- [ ] f" "$("$CHOP" -f marks.txt)"
+check "markers are classified when piped" "- [x] b
+- [x] d" "$(cat marks.txt | "$CHOP" -id)"
+
+# Every newline kernel splits lines the same way
+cp long.txt many.txt
+awk 'BEGIN { for (i = 1; i <= 3000; i++) printf "- [%s] item %d%s\n", i % 3 ? " " : "x", i, i % 7 ? "" : "\r"; printf "- [ ] last" }' >> many.txt
+"$CHOP" -f many.txt > want.txt
+for k in portable sse2; do
+    if CHOP_SCAN=$k "$CHOP" -f many.txt | cmp -s - want.txt &&
+       cat many.txt | CHOP_SCAN=$k "$CHOP" | cmp -s - want.txt; then
+        ok
+    else
+        not_ok "CHOP_SCAN=$k splits lines like the default kernel"
+    fi
+done
+check "no line is lost or split" 3003 "$(wc -l < want.txt | tr -d ' ')"
+
+# -j splits files over 2 MB into chunks; output must not depend on it
+awk 'BEGIN { for (i = 1; i <= 120000; i++) printf "%s item number %d%s\n", i % 5 ? "- [ ]" : "* [x]", i, i % 11 ? "" : "\r"; printf "- [>] last" }' > big.txt
+for args in "" "-it" "-id" "-xt" "-md"; do
+    "$CHOP" -f big.txt -j 1 $args > one.txt
+    if "$CHOP" -f big.txt -j 4 $args | cmp -s - one.txt &&
+       "$CHOP" -f big.txt -j 0 $args | cmp -s - one.txt; then
+        ok
+    else
+        not_ok "-j 4 and -j 0 print what -j 1 does ($args)"
+    fi
+done
+check "-j keeps every line" 120001 "$("$CHOP" -f big.txt -j 4 | wc -l | tr -d ' ')"
+
+# Ids count on across -j chunks
+check "--id picks the same items with -j 4" "- [ ] item number 1
+- [ ] item number 59999
+- [x] item number 60000
+- [>] last" "$("$CHOP" -f big.txt -j 4 --id=1,59999-60000,120001)"
+check "--match and --id agree with -j 4" "- [ ] item number 1001" "$("$CHOP" -f big.txt -j 4 --id=1001-1005 --match='number 1001')"
+
+# Filter expressions
+printf -- '- [ ] deploy api\n- [x] deploy web\n- [>] write docs\n- [ ] fix login\n' > expr.txt
+where() {
+    "$CHOP" -e "$1" < expr.txt | tr '\n' '|'
+}
+check "is: takes a status list" "- [ ] deploy api|- [>] write docs|- [ ] fix login|" "$(where 'is:todo,ip')"
+check "side by side tests are and-ed" "- [ ] deploy api|" "$(where 'not is:done has:deploy')"
+check "not binds tighter than or" "- [ ] deploy api|- [x] deploy web|- [>] write docs|- [ ] fix login|" "$(where 'not is:done or has:web')"
+check "and binds tighter than or" "- [x] deploy web|- [ ] fix login|" "$(where 'has:fix or has:deploy is:done')"
+check "parentheses group" "- [>] write docs|- [ ] fix login|" "$(where 'not (is:done or has:deploy)')"
+check "quoted values keep parentheses and spaces" "- [x] deploy web|- [>] write docs|" "$(where "re:'^(write|deploy w)'")"
+check "id: ranges" "- [x] deploy web|- [>] write docs|" "$(where 'id:2-3')"
+# and/or jump past the rest of their operand once it is decided
+check "a false and skips to the next or" "- [ ] deploy api|- [>] write docs|" "$(where 'is:done has:api or is:ip or has:api')"
+check "not of a decided group" "- [ ] fix login|" "$(where 'not (has:deploy or is:ip) is:todo')"
+check "a true or inside an and" "- [x] deploy web|" "$(where '(is:done or is:ip) and not has:docs')"
+check "options are and-ed into the expression" "- [ ] deploy api|" "$("$CHOP" -it --match=deploy < expr.txt | tr '\n' '|')"
+for bad in '(' 'has:' 'foo:bar' 'is:nope' 'is:todo)'; do
+    if "$CHOP" -e "$bad" < expr.txt > /dev/null 2>&1; then
+        not_ok "-e '$bad' is rejected"
+    else
+        ok
+    fi
+done
+
+# -w replaces the file atomically and keeps its mode
+inode() {
+    ls -i "$1" | awk '{ print $1 }'
+}
+mode() {
+    ls -l "$1" | cut -c1-10
+}
+printf -- '* [ ] a\n- [x] b\n- [ ] c\n' > w.txt
+chmod 640 w.txt
+before=$(inode w.txt)
+"$CHOP" -f w.txt -xd -w
+check "-w writes the filtered list" "- [ ] a
+- [ ] c" "$(cat w.txt)"
+check "-w keeps the mode" "-rw-r-----" "$(mode w.txt)"
+if [ "$(inode w.txt)" != "$before" ]; then ok; else not_ok "-w renames a new file into place"; fi
+if ls .w.txt* w.txt.* > /dev/null 2>&1; then not_ok "-w leaves no temp file"; else ok; fi
+
+# A mark on canonical lines patches the status bytes in place
+before=$(inode w.txt)
+"$CHOP" -f w.txt -md -w
+check "an in-place mark" "- [x] a
+- [x] c" "$(cat w.txt)"
+check "an in-place mark keeps the inode" "$before" "$(inode w.txt)"
+check "an in-place mark keeps the mode" "-rw-r-----" "$(mode w.txt)"
+
+# -w through a symlink rewrites the target
+ln -s w.txt link.txt
+"$CHOP" -f link.txt -mt -w
+if [ -L link.txt ]; then ok; else not_ok "-w keeps a symlink"; fi
+check "-w through a symlink" "- [ ] a
+- [ ] c" "$(cat w.txt)"
+
+# --index never answers from a stale index
+printf -- '- [ ] a\n- [x] b\n' > idx.txt
+check "--index builds the index" "- [ ] a" "$("$CHOP" -f idx.txt --index -it)"
+if [ -f .idx.txt.chopidx ]; then ok; else not_ok "--index saves .FILE.chopidx"; fi
+check "--index reuses it" "- [ ] a" "$("$CHOP" -f idx.txt --index -it)"
+printf -- '- [ ] c\n- [ ] d' >> idx.txt
+check "--index sees appended lines" "- [ ] a
+- [ ] c
+- [ ] d" "$("$CHOP" -f idx.txt --index -it)"
+printf -- '\n- [ ] e\n' >> idx.txt
+check "--index completes a partial last line" "- [ ] a
+- [ ] c
+- [ ] d
+- [ ] e" "$("$CHOP" -f idx.txt --index -it)"
+printf -- '- [x] a\n- [ ] b\n- [x] c\n- [ ] d\n- [ ] e\n- [ ] f\n' > idx.txt
+check "--index sees a rewrite that grew the file" "- [ ] b
+- [ ] d
+- [ ] e
+- [ ] f" "$("$CHOP" -f idx.txt --index -it)"
+printf -- '- [ ] x\n' > idx.txt
+check "--index sees a shorter rewrite" "- [ ] x" "$("$CHOP" -f idx.txt --index -it)"
+printf -- '- [x] x\n' > idx.txt
+touch -t 200001010000 idx.txt
+check "--index sees a same-size rewrite" "" "$("$CHOP" -f idx.txt --index -it)"
+check "--index with a mark" "- [x] x" "$("$CHOP" -f idx.txt --index -md)"
+
+# Counting prints no items
+check "--count" 4 "$("$CHOP" --count < expr.txt)"
+check "--count with a filter" 2 "$("$CHOP" --count -it < expr.txt)"
+check "--count with has:" 1 "$("$CHOP" --count -e 'has:deploy is:todo' < expr.txt)"
+check "--count of a big file with -j 4" "$("$CHOP" -f big.txt -id | wc -l | tr -d ' ')" "$("$CHOP" -f big.txt -j 4 --count -id)"
+check "--stats" "todo	2
+in-progress	1
+done	1
+total	4" "$("$CHOP" --stats < expr.txt)"
+check "--stats=json" '{"todo":1,"in-progress":0,"done":1,"total":2}' "$("$CHOP" --stats=json -e has:deploy < expr.txt)"
+check "--count sums files" 8 "$("$CHOP" --count expr.txt expr.txt)"
+out=$("$CHOP" --count expr.txt missing.txt 2>/dev/null)
+check "--count exits 1 on a missing file" 1 $?
+check "a missing path stops the run before any output" "" "$out"
+
+# Directories are walked in sorted order and every line names its file
+mkdir -p tree/b/c tree/a tree/.hidden
+printf -- '- [ ] in a\n' > tree/a/x.txt
+printf -- '- [ ] in b\n' > tree/b/y.md
+printf -- '- [x] in c\n- [ ] c2\n' > tree/b/c/z.txt
+printf -- '- [ ] top\n' > tree/top.txt
+printf -- '- [ ] hidden\n' > tree/.hidden/q.txt
+printf -- '- [ ] hidden\n' > tree/.h.txt
+check "a directory tree in sorted order" "tree/a/x.txt:- [ ] in a
+tree/b/c/z.txt:- [x] in c
+tree/b/c/z.txt:- [ ] c2
+tree/b/y.md:- [ ] in b
+tree/top.txt:- [ ] top" "$("$CHOP" tree)"
+check "--name and argument order" "tree/b/c/z.txt:- [ ] c2
+tree/top.txt:- [ ] top
+tree/a/x.txt:- [ ] in a" "$("$CHOP" --name='*.txt' -it tree/b tree/top.txt tree/a)"
+check "the same with -j 1" "$("$CHOP" tree)" "$("$CHOP" -j 1 tree)"
+check "one plain file has no prefix" "- [ ] in a" "$("$CHOP" tree/a/x.txt)"
+"$CHOP" -xd -w tree
+check "-w rewrites every file" "- [ ] c2" "$(cat tree/b/c/z.txt)"
+check "-w skips hidden files" "- [ ] hidden" "$(cat tree/.h.txt)"
+
+# --diff keys items by text and exits like diff(1)
+printf -- '- [ ] a\n- [ ] b\n- [x] c\n' > d1.txt
+printf -- '- [x] a\n-  [ ]  b  \n- [ ] d\n' > d2.txt
+printf -- '- [ ] b\n- [ ] a\n- [x] c\n' > d3.txt
+out=$("$CHOP" --diff d1.txt d2.txt)
+check "--diff exits 1 on differences" 1 $?
+check "--diff lists removed, changed and added items" "- - [x] c
+~ - [x] a
++ - [ ] d" "$out"
+out=$("$CHOP" --diff d1.txt d3.txt)
+check "--diff exits 0 when only the order differs" 0 $?
+check "--diff prints nothing then" "" "$out"
+"$CHOP" --diff d1.txt missing.txt 2>/dev/null
+check "--diff exits 2 on trouble" 2 $?
+
+# Inline #tags, @owners and due: dates
+printf -- '- [ ] fix login #web @alice due:2024-03-01\n- [x] deploy #ops #web @bob due:2024-02-01\n- [>] write docs #docs\n- [ ] plain item\n- [ ] #web twice #web @alice @carol due:2024-03-01 due:2025-01-01\n' > meta.txt
+check "--group-by=tag" "## #docs
+- [>] write docs #docs
+
+## #ops
+- [x] deploy #ops #web @bob due:2024-02-01
+
+## #web
+- [ ] fix login #web @alice due:2024-03-01
+- [x] deploy #ops #web @bob due:2024-02-01
+- [ ] #web twice #web @alice @carol due:2024-03-01 due:2025-01-01
+
+## (none)
+- [ ] plain item" "$("$CHOP" --group-by=tag < meta.txt)"
+check "--group-by=owner --count" "@alice	2
+@bob	1
+@carol	1
+(none)	2" "$("$CHOP" --group-by=owner --count < meta.txt)"
+check "--group-by=due takes the first date" "2024-02-01	1
+2024-03-01	2
+(none)	2" "$("$CHOP" --group-by=due --count < meta.txt)"
+check "--tag and --owner" "- [ ] #web twice #web @alice @carol due:2024-03-01 due:2025-01-01" "$("$CHOP" --tag=web,docs --owner=carol < meta.txt)"
+check "--due range" "- [x] deploy #ops #web @bob due:2024-02-01" "$("$CHOP" --due=..2024-02-15 < meta.txt)"
+check "tag: and due: in an expression" "- [ ] fix login #web @alice due:2024-03-01
+- [>] write docs #docs" "$("$CHOP" -e 'tag:docs or (tag:web due:2024-03-01 not owner:carol)' < meta.txt)"
+
+# tag: takes any number of names
+names=$(seq 1 100 | sed 's/^/t/' | paste -sd, -)
+check "tag: with 100 names" "- [ ] x #t99" "$(printf -- '- [ ] x #t99\n- [ ] y #t101\n' | "$CHOP" --tag="$names")"
+
+# --limit and --offset with -w would save only the window
+printf -- '- [ ] a\n- [x] b\n- [ ] c\n' > todos.txt
+cp todos.txt before.txt
+if "$CHOP" -f todos.txt --limit=1 -w 2>/dev/null; then
+    not_ok "--limit with -w is rejected"
+else
+    ok
+fi
+"$CHOP" -f todos.txt --offset=1 -w 2>/dev/null
+if cmp -s todos.txt before.txt; then
+    ok
+else
+    not_ok "--limit/--offset with -w leave the file alone"
+fi
+
+# --uniq filters the merged status: a done copy anywhere makes it done
+printf -- '- [ ] a\n- [ ] b\n- [x] a\n' > dup.txt
+check "--uniq -it drops an item done elsewhere" "- [ ] b" "$("$CHOP" --uniq -it < dup.txt)"
+check "--uniq -id keeps it" "- [x] a" "$("$CHOP" --uniq -id < dup.txt)"
+
+# --merge keeps an item listed twice as two items, also with -w
+printf -- '- [ ] a\n- [ ] b\n- [ ] a\n' > base.txt
+cp base.txt ours.txt
+printf -- '- [ ] a\n- [x] b\n- [ ] a\n' > theirs.txt
+"$CHOP" --merge base.txt ours.txt theirs.txt -w 2>/dev/null
+check "--merge exits 0 without conflicts" 0 $?
+check "--merge keeps repeated items" "- [ ] a
+- [x] b
+- [ ] a" "$(cat ours.txt)"
+
+# A conflict is resolved, but the exit status says so
+printf -- '- [x] a\n- [ ] b\n- [ ] a\n' > ours.txt
+printf -- '- [>] a\n- [ ] b\n- [ ] a\n' > theirs.txt
+out=$("$CHOP" --merge base.txt ours.txt theirs.txt 2>/dev/null)
+check "--merge exits 1 after a conflict" 1 $?
+check "--merge resolves a conflict to the higher status" "- [x] a
+- [ ] b
+- [ ] a" "$out"
+
+# The daemon is opt-in through CHOP_SOCKET
+if "$CHOP" --serve 2>/dev/null; then
+    not_ok "--serve needs CHOP_SOCKET"
+else
+    ok
+fi
+CHOP_SOCKET=$T/chop.sock "$CHOP" --serve 2>/dev/null &
+daemon=$!
+n=0
+while [ ! -S chop.sock ] && [ $n -lt 50 ]; do
+    sleep 0.1
+    n=$((n + 1))
+done
+printf -- '- [ ] a\n- [x] b\n' > served.txt
+check "a query through the daemon" "- [ ] a" "$(CHOP_SOCKET=$T/chop.sock "$CHOP" -f served.txt -it)"
+printf -- '- [ ] c\n' >> served.txt
+check "the daemon sees a changed file" "- [ ] a
+- [ ] c" "$(CHOP_SOCKET=$T/chop.sock "$CHOP" -f served.txt -it)"
+kill $daemon
+wait $daemon 2>/dev/null
+if [ -e chop.sock ]; then not_ok "the daemon removes its socket"; else ok; fi
+
+echo "$pass passed, $fail failed"
+[ "$fail" -eq 0 ]